@@ -6,6 +6,7 @@
 #pragma once
 
 #include <cmath>
+#include <algorithm>
 
 #include "image.hpp"
 
@@ -83,10 +84,32 @@ private:
     const int _opacity;
 };
 
+// Zς݃At@̃sNZAXg[gAt@ɖ߂Ă珈
+template<class Function>
+class straight_alpha_function
+{
+public:
+    straight_alpha_function(const Function &f)
+        : _f(f), _table(alpha_table::instance())
+    {
+    }
+    inline void operator()(color &pixel) const
+    {
+        color straight = unpremultiply_color(pixel, _table);
+        _f(straight);
+        pixel = premultiply_color(straight, _table);
+    }
+private:
+    const Function _f;
+    const alpha_table &_table;
+};
+
 class nearest_neighbor_sampler
 {
 public:
-    inline void operator()(const image &src, const double x, const double y, const int px_width, const int px_height, color &result) const
+    // src  image Ɠ悤 pixel  pixel_no_check ŎQƂłΗǂAindexed_image g
+    template<class Source>
+    inline void operator()(const Source &src, const double x, const double y, const int px_width, const int px_height, color &result) const
     {
         // sNZ߂
         int x0 = static_cast<int>(x);
@@ -99,7 +122,8 @@ public:
 class bilinear_sampler
 {
 public:
-    inline void operator()(const image &src, const double x, const double y, const int px_width, const int px_height, color &result) const
+    template<class Source>
+    inline void operator()(const Source &src, const double x, const double y, const int px_width, const int px_height, color &result) const
     {
         // sNZ߂
         int x0 = static_cast<int>(x);
@@ -110,8 +134,8 @@ public:
         double b = y - y0;
 
         //  +1 W߂Ă
-        int x1 = min(x0 + 1, px_width);
-        int y1 = min(y0 + 1, px_height);
+        int x1 = std::min(x0 + 1, px_width);
+        int y1 = std::min(y0 + 1, px_height);
 
         // ӂ 4 sNZ擾
         const color &p00 = src.pixel_no_check(x0, y0);
@@ -135,7 +159,8 @@ private:
 class bicubic_sampler
 {
 public:
-    inline void operator()(const image &src, const double x, const double y, const int px_width, const int px_height, color &result) const
+    template<class Source>
+    inline void operator()(const Source &src, const double x, const double y, const int px_width, const int px_height, color &result) const
     {
         // p[^쐬
         static const int a = -1;
@@ -155,10 +180,10 @@ public:
             int x1 = x0 + i;
 
             // sNZԂ̋߂
-            double dist_x = abs(x1 - x);
+            double dist_x = std::abs(x1 - x);
 
             // ̈OQƂȂ悤ɂ
-            x1 = min(max(x1, 0), px_width);
+            x1 = std::min(std::max(x1, 0), px_width);
 
             // X ̏d
             double x_weight = 0.0;
@@ -184,7 +209,7 @@ public:
                 int y1 = y0 + j;
 
                 // sNZԂ̋߂
-                double dist_y = abs(y1 - y);
+                double dist_y = std::abs(y1 - y);
 
                 // d
                 double weight = x_weight;
@@ -204,7 +229,7 @@ public:
                 }
 
                 // ͈͓Ȃ̂͊mς݂Ȃ̂Ńm[`FbNŃsNZl擾
-                const color &color = src.pixel_no_check(x1, min(max(y1, 0), px_height));
+                const color &color = src.pixel_no_check(x1, std::min(std::max(y1, 0), px_height));
 
                 // dݕtȂ炻ꂼ̉fl𑫂Ă
                 alpha += color.alpha() * weight;
@@ -225,7 +250,8 @@ template<int n>
 class lanczos_sampler
 {
 public:
-    inline void operator()(const image &src, const double x, const double y, const int px_width, const int px_height, color &result) const
+    template<class Source>
+    inline void operator()(const Source &src, const double x, const double y, const int px_width, const int px_height, color &result) const
     {
         // Lanczos ̃p[^vZ
         static const int nx = n - 1;
@@ -250,10 +276,10 @@ public:
             int x1 = x0 + i;
 
             // sNZԂ̋߂
-            double dist_x = abs(x1 - x);
+            double dist_x = std::abs(x1 - x);
 
             // ̈OQƂȂ悤ɂ
-            x1 = min(max(x1, 0), px_width);
+            x1 = std::min(std::max(x1, 0), px_width);
 
             // X ̏d
             double x_weight = 0.0;
@@ -280,7 +306,7 @@ public:
                 int y1 = y0 + j;
 
                 // sNZԂ̋߂
-                double dist_y = abs(y1 - y);
+                double dist_y = std::abs(y1 - y);
 
                 // d
                 double weight = x_weight;
@@ -0,0 +1,320 @@
+/*
+    allocator.hpp
+    COLORS Buffer Allocator Library
+*/
+
+#pragma once
+
+#include <new>
+#include <vector>
+#include <mutex>
+#include <cstdlib>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#ifdef MADV_HUGEPAGE
+#define COLORS_USE_HUGEPAGE
+#endif
+#endif /* __linux__ */
+
+// s̐擪𑵂鋫E (LbVC SIMD WX^̕)
+static const int row_alignment = 64;
+
+// Transparent Huge Page ̃TCY
+static const size_t hugepage_size = 2 * 1024 * 1024;
+
+// ACgw肵ămۂAmۂłȂꍇ std::bad_alloc 𓊂
+inline void *aligned_allocate(size_t size, size_t alignment = row_alignment)
+{
+#ifdef _MSC_VER
+    void *p = _aligned_malloc(size, alignment);
+#else
+    void *p = NULL;
+    if (posix_memalign(&p, alignment, size) != 0)
+    {
+        p = NULL;
+    }
+#endif /* _MSC_VER */
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+inline void aligned_free(void *p)
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    free(p);
+#endif /* _MSC_VER */
+}
+
+// v[mۂobt@
+struct buffer_block
+{
+    void *data;
+    // ۂɊmۂTCY
+    size_t size;
+    // TCYNX̔ԍAv[̑ΏۊȌꍇ -1
+    int index;
+    // Huge Page g悤Ɋmۂ
+    bool huge;
+};
+
+// ꂽobt@TCYNXɕێĎg񂷃v[
+// 摜̉Ɠǂݍ݂JԂĂ malloc ƃy[WtH[g
+class buffer_pool
+{
+public:
+    buffer_pool()
+        : _cached(0), _limit(default_limit), _hugepage_threshold(default_hugepage_threshold), _hugepage_bytes(0), _free(class_count * 2)
+    {
+    }
+    ~buffer_pool()
+    {
+        trim();
+    }
+    // vZXŜŋLv[
+    // A[hɔj摜g悤ɁAӐ}IɔjȂ
+    static buffer_pool &instance()
+    {
+        static buffer_pool *pool = new buffer_pool();
+        return *pool;
+    }
+    // size ȏ̃obt@mۂAobt@̓e͏Ȃ
+    buffer_block allocate(size_t size)
+    {
+        buffer_block block;
+
+        block.index = size_class(size);
+        block.size = block.index < 0 ? size : class_size(block.index);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            // 傫ȃobt@ TLB ~X炷߂ Huge Page g
+            block.huge = use_hugepage(block.size);
+
+            if (block.huge)
+            {
+                block.size = hugepage_round(block.size);
+            }
+
+            if (block.index >= 0)
+            {
+                std::vector<void *> &blocks = _free[block.index * 2 + block.huge];
+
+                if (!blocks.empty())
+                {
+                    block.data = blocks.back();
+                    blocks.pop_back();
+
+                    _cached -= block.size;
+
+                    if (block.huge)
+                    {
+                        _hugepage_bytes += block.size;
+                    }
+
+                    return block;
+                }
+            }
+        }
+
+        // mۂƃy[W̐ݒ͎Ԃ̂ŁAbNĂs
+        // mۂɎsƗÔŁAgpʂ͊mۂłĂ
+        block.data = allocate_block(block.size, block.huge);
+
+        if (block.huge)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            _hugepage_bytes += block.size;
+        }
+
+        return block;
+    }
+    // allocate Ŋmۂobt@ԋp
+    void release(const buffer_block &block)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            if (block.huge)
+            {
+                _hugepage_bytes -= block.size;
+            }
+
+            // 𒴂镪 OS ɕԂ
+            if (block.index >= 0 && _cached + block.size <= _limit)
+            {
+                _free[block.index * 2 + block.huge].push_back(block.data);
+                _cached += block.size;
+
+                return;
+            }
+        }
+
+        aligned_free(block.data);
+    }
+    // ێĂSẴobt@
+    void trim()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        shrink(0);
+    }
+    // ێĂobt@̍vTCY
+    size_t cached()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        return _cached;
+    }
+    // ێobt@̏A0 ̏ꍇ͎g񂳂Ȃ
+    size_t limit()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        return _limit;
+    }
+    void limit(size_t value)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _limit = value;
+
+        shrink(value);
+    }
+    // Huge Page gobt@̍ŏTCYA0 ̏ꍇ͎gȂ
+    size_t hugepage_threshold()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        return _hugepage_threshold;
+    }
+    void hugepage_threshold(size_t value)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _hugepage_threshold = value;
+    }
+    // gp̃obt@̂ Huge Page g悤ɊmۂTCY
+    size_t hugepage_bytes()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        return _hugepage_bytes;
+    }
+private:
+    buffer_pool(const buffer_pool &);
+    buffer_pool &operator=(const buffer_pool &);
+    // TCYNX̍\A4 KiB  64 MiB ܂ł 2 ׂ̂斈 4 
+    static const int min_shift = 12;
+    static const int max_shift = 26;
+    static const int class_count = (max_shift - min_shift) * 4 + 1;
+    static const size_t default_limit = 64 * 1024 * 1024;
+    static const size_t default_hugepage_threshold = 4 * 1024 * 1024;
+
+    // TCYNX̔ԍ߂AΏۊȌꍇ -1 Ԃ
+    static int size_class(size_t size)
+    {
+        if (size > (static_cast<size_t>(1) << max_shift))
+        {
+            return -1;
+        }
+        if (size <= (static_cast<size_t>(1) << min_shift))
+        {
+            return 0;
+        }
+
+        // size - 1 ̍ŏʃrbg߂
+        int shift = min_shift;
+        while ((size - 1) >> (shift + 1) != 0)
+        {
+            shift += 1;
+        }
+
+        size_t base = static_cast<size_t>(1) << shift;
+        int step = static_cast<int>((size - 1 - base) / (base / 4));
+
+        return (shift - min_shift) * 4 + step + 1;
+    }
+    static size_t class_size(int index)
+    {
+        if (index == 0)
+        {
+            return static_cast<size_t>(1) << min_shift;
+        }
+
+        size_t base = static_cast<size_t>(1) << (min_shift + (index - 1) / 4);
+
+        return base + ((index - 1) % 4 + 1) * (base / 4);
+    }
+    static size_t hugepage_round(size_t size)
+    {
+        return (size + hugepage_size - 1) / hugepage_size * hugepage_size;
+    }
+    // bN擾ԂŌĂԂ
+    bool use_hugepage(size_t size) const
+    {
+#ifdef COLORS_USE_HUGEPAGE
+        return _hugepage_threshold != 0 && size >= _hugepage_threshold;
+#else
+        return false;
+#endif /* COLORS_USE_HUGEPAGE */
+    }
+    static void *allocate_block(size_t size, bool huge)
+    {
+        if (!huge)
+        {
+            return aligned_allocate(size);
+        }
+
+        // 2 MiB EɑĊmۂAJ[l Huge Page g悤ɓ`
+        void *p = aligned_allocate(size, hugepage_size);
+
+#ifdef COLORS_USE_HUGEPAGE
+        madvise(p, size, MADV_HUGEPAGE);
+#endif /* COLORS_USE_HUGEPAGE */
+
+        return p;
+    }
+    // bN擾ԂŌĂԂ
+    void shrink(size_t limit)
+    {
+        for (int i = class_count * 2 - 1; i >= 0 && _cached > limit; --i)
+        {
+            std::vector<void *> &blocks = _free[i];
+
+            size_t size = class_size(i / 2);
+
+            if (i % 2 != 0)
+            {
+                size = hugepage_round(size);
+            }
+
+            while (!blocks.empty() && _cached > limit)
+            {
+                aligned_free(blocks.back());
+                blocks.pop_back();
+
+                _cached -= size;
+            }
+        }
+    }
+private:
+    std::mutex _mutex;
+    size_t _cached;
+    size_t _limit;
+    size_t _hugepage_threshold;
+    size_t _hugepage_bytes;
+    // TCYNX̋󂫃obt@AHuge Page ĝ͕ʂɕێ
+    std::vector<std::vector<void *> > _free;
+};
\ No newline at end of file
@@ -0,0 +1,260 @@
+/*
+    bitmap.hpp
+    COLORS Bitmap Loader Library
+*/
+
+#pragma once
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define COLORS_USE_SSSE3
+#endif
+
+#include "saori.h"
+#include "image.hpp"
+#include "mapped_file.hpp"
+
+// gGfBA̐ǂݍ
+inline unsigned int read_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+inline unsigned int read_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned int>(p[3]) << 24);
+}
+
+// BGR  1 s color ̕тɕϊAdst ͉摜̍s̐擪 row_alignment ɑĂ
+inline void convert_bgr_row(const unsigned char *src, color *dst, int width)
+{
+    unsigned char *p = reinterpret_cast<unsigned char *>(dst);
+
+    int x = 0;
+
+#ifdef COLORS_USE_SSSE3
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+    // 16 oCgǂݍނ̂ŁAzȂ͈͂ 4 sNZ
+    for (; x + 6 <= width; x += 4)
+    {
+        __m128i bgr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 3));
+        _mm_store_si128(reinterpret_cast<__m128i *>(p + x * 4), _mm_or_si128(_mm_shuffle_epi8(bgr, shuffle), opaque));
+    }
+#endif /* COLORS_USE_SSSE3 */
+
+    for (; x < width; ++x)
+    {
+        p[x * 4 + 0] = src[x * 3 + 2];
+        p[x * 4 + 1] = src[x * 3 + 1];
+        p[x * 4 + 2] = src[x * 3 + 0];
+        p[x * 4 + 3] = 255;
+    }
+}
+
+// 32bit ̃sNZł R, G, B, A ̃oCgʒu
+const int bgra_channel_order[4] = { 2, 1, 0, 3 };
+
+// BITFIELDS ̃}XNsNZ̃oCgʒu߂A8bit PʂɑĂȂꍇ -1 Ԃ
+inline int bitfield_channel_byte(unsigned int mask)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        if (mask == (0xFFu << (i * 8)))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 32bit  1 s color ̕тɕϊAdst ͉摜̍s̐擪 row_alignment ɑĂ
+// order ɂ R, G, B, A ĂoCgʒuw肷
+inline void convert_bgra_row(const unsigned char *src, color *dst, int width, const int *order, bool has_alpha)
+{
+    unsigned char *p = reinterpret_cast<unsigned char *>(dst);
+
+    int x = 0;
+
+#ifdef COLORS_USE_SSSE3
+    const char r = static_cast<char>(order[0]), g = static_cast<char>(order[1]), b = static_cast<char>(order[2]), a = static_cast<char>(order[3]);
+    const __m128i shuffle = _mm_setr_epi8(r, g, b, a, r + 4, g + 4, b + 4, a + 4, r + 8, g + 8, b + 8, a + 8, r + 12, g + 12, b + 12, a + 12);
+    const __m128i opaque = _mm_set1_epi32(has_alpha ? 0 : static_cast<int>(0xFF000000));
+
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 4));
+        _mm_store_si128(reinterpret_cast<__m128i *>(p + x * 4), _mm_or_si128(_mm_shuffle_epi8(bgra, shuffle), opaque));
+    }
+#endif /* COLORS_USE_SSSE3 */
+
+    for (; x < width; ++x)
+    {
+        p[x * 4 + 0] = src[x * 4 + order[0]];
+        p[x * 4 + 1] = src[x * 4 + order[1]];
+        p[x * 4 + 2] = src[x * 4 + order[2]];
+        p[x * 4 + 3] = has_alpha ? src[x * 4 + order[3]] : 255;
+    }
+}
+
+// 24/32bit ̔񈳏k BGR(A) 摜sPʂŕϊ
+inline bool convert_bgr_image(const unsigned char *pixels, size_t row_bytes, bool bottom_up, int depth, const int *order, bool has_alpha, image &dst)
+{
+    int width = dst.width();
+    int height = dst.height();
+
+    for (int y = 0; y < height; ++y)
+    {
+        // {gAbv̏ꍇ͍ŏIsł
+        const unsigned char *src = pixels + row_bytes * (bottom_up ? height - 1 - y : y);
+        color *row = dst.row(y);
+
+        if (depth == 24)
+        {
+            convert_bgr_row(src, row, width);
+        }
+        else
+        {
+            convert_bgra_row(src, row, width, order, has_alpha);
+        }
+    }
+    return true;
+}
+
+bool bmp_load_image(const mapped_file &file, image &dst)
+{
+    const unsigned char *data = file.data();
+    size_t size = file.size();
+
+    // BITMAPFILEHEADER + BITMAPINFOHEADER
+    if (size < 54 || data[0] != 'B' || data[1] != 'M')
+    {
+        return false;
+    }
+
+    unsigned int offset = read_le32(data + 10);
+    unsigned int header_size = read_le32(data + 14);
+    int width = static_cast<int>(read_le32(data + 18));
+    int height = static_cast<int>(read_le32(data + 22));
+    unsigned int depth = read_le16(data + 28);
+    unsigned int compression = read_le32(data + 30);
+
+    // 24/32bit ̔񈳏kƁA32bit  BI_BITFIELDS ݂̂ɑΉ
+    if (header_size < 40 || 14 + static_cast<size_t>(header_size) > size || width <= 0 || height == 0 || (depth != 24 && depth != 32))
+    {
+        return false;
+    }
+    if (compression != 0 && !(compression == 3 && depth == 32))
+    {
+        return false;
+    }
+
+    int order[4] = { bgra_channel_order[0], bgra_channel_order[1], bgra_channel_order[2], bgra_channel_order[3] };
+
+    // V3 ȍ~̃wb_ŃAt@}XNw肳Ăꍇ̂݃At@g
+    unsigned int alpha_mask = depth == 32 && header_size >= 56 ? read_le32(data + 66) : 0;
+
+    if (compression == 3)
+    {
+        // RGB ̃}XN̓wb_̒ォAV2 ȍ~̃wb_̒ɂ
+        if (size < 66)
+        {
+            return false;
+        }
+
+        order[0] = bitfield_channel_byte(read_le32(data + 54));
+        order[1] = bitfield_channel_byte(read_le32(data + 58));
+        order[2] = bitfield_channel_byte(read_le32(data + 62));
+
+        if (alpha_mask != 0)
+        {
+            order[3] = bitfield_channel_byte(alpha_mask);
+        }
+
+        // 8bit PʂɑĂȂ}XNɂ͑ΉȂ
+        if (order[0] < 0 || order[1] < 0 || order[2] < 0 || order[3] < 0)
+        {
+            return false;
+        }
+    }
+
+    // ̏ꍇ̓gbv_EAINT_MIN ͕𔽓]łȂ
+    if (height == INT_MIN)
+    {
+        return false;
+    }
+
+    bool bottom_up = height > 0;
+    height = bottom_up ? height : -height;
+
+    // 摜ƂĊmۂłȂ傫́As̃oCg߂Oɒe
+    if (!image::valid_size(width, height))
+    {
+        return false;
+    }
+
+    // s 4 oCgEɑĂ
+    size_t row_bytes = ((static_cast<size_t>(width) * depth + 31) / 32) * 4;
+
+    // Z 32bit Ōӂꂷ̂ŁAc̃oCgs̃oCgŊĔׂ
+    if (offset > size || static_cast<size_t>(height) > (size - offset) / row_bytes)
+    {
+        return false;
+    }
+
+    if (!dst.resize(width, height, false))
+    {
+        return false;
+    }
+
+    return convert_bgr_image(data + offset, row_bytes, bottom_up, depth, order, alpha_mask != 0, dst);
+}
+
+bool tga_load_image(const mapped_file &file, image &dst)
+{
+    const unsigned char *data = file.data();
+    size_t size = file.size();
+
+    if (size < 18)
+    {
+        return false;
+    }
+
+    unsigned int id_length = data[0];
+    unsigned int colormap_type = data[1];
+    unsigned int image_type = data[2];
+    int width = static_cast<int>(read_le16(data + 12));
+    int height = static_cast<int>(read_le16(data + 14));
+    unsigned int depth = data[16];
+    unsigned int descriptor = data[17];
+
+    // 񈳏k̃tJ[݂̂ɑΉ
+    if (colormap_type != 0 || image_type != 2 || width <= 0 || height <= 0 || (depth != 24 && depth != 32))
+    {
+        return false;
+    }
+
+    // rbg 5 Ă΃gbv_E
+    bool bottom_up = (descriptor & 0x20) == 0;
+
+    if (!image::valid_size(width, height))
+    {
+        return false;
+    }
+
+    size_t offset = 18 + id_length;
+    size_t row_bytes = static_cast<size_t>(width) * (depth / 8);
+
+    if (offset > size || static_cast<size_t>(height) > (size - offset) / row_bytes)
+    {
+        return false;
+    }
+
+    if (!dst.resize(width, height, false))
+    {
+        return false;
+    }
+
+    return convert_bgr_image(data + offset, row_bytes, bottom_up, depth, bgra_channel_order, (descriptor & 0x0F) != 0, dst);
+}
\ No newline at end of file
@@ -3,22 +3,237 @@
     COLORS Core Library
 */
 
-#include <map>
+#include <vector>
+#include <atomic>
 
 #include "saori.h"
 
 #include "image.hpp"
 #include "png.hpp"
+#include "bitmap.hpp"
 #include "algorithm.hpp"
 #include "drawing.hpp"
-
-typedef std::multimap<int, std::unique_ptr<image>> image_multimap;
+#include "filter.hpp"
+#include "mask.hpp"
+#include "stream.hpp"
+#include "parallel.hpp"
+#include "tile.hpp"
+#include "store.hpp"
 
 // SẲ摜ێRei
-static image_multimap images;
+static image_store images;
+
+// ǂݍ񂾃t@C̉摜LLbV
+static image_cache loaded_images;
+
+// ݒ͔񓯊̌Ăяoǂ܂̂ŕsɓǂݏ
+// 摜Zς݃At@ŕێ
+static std::atomic<bool> premultiplied_images(false);
+
+// pbg` PNG pbĝ܂ܕێ
+static std::atomic<bool> indexed_images(false);
+
+// 񏈗Ɏg[J[v[ƁA[J[̍Ɨ̈
+static std::unique_ptr<worker_pool> workers;
+static std::vector<stream_scratch> worker_scratches;
+
+// [J[v[ɍ쐬鎞̃bN
+static std::mutex workers_mutex;
+
+// 莞ԃANZXĂȂ摜k܂ł̎ (b)A0 ̏ꍇ͈kȂ
+static std::atomic<unsigned long long> compress_timeout(0);
+
+// k 1 ̃XbhōsAIʂ̓NGXg̍Ԃɔf
+static std::unique_ptr<worker_pool> compressor;
+static std::vector<std::shared_ptr<compress_job>> compressed_jobs;
+static std::mutex compressed_jobs_mutex;
+
+// IɁAL[ɎcĂ鈳ksɎ̂Ă邽߂̃tO
+static std::atomic<bool> compress_cancelled(false);
+
+#define FIND_IMAGE_ENTRY(entry, index) FIND_IMAGE_ENTRY_KEEP(entry, index, 0)
+#define FIND_IMAGE_ENTRY_KEEP(entry, index, keep) image_entry *entry = find_image_entry(index, keep); if (entry == NULL) { return SAORIRESULT_BAD_REQUEST; }
+#define INSERT_IMAGE_ENTRY(id, value) int id = images.insert(value); if (id == 0) { return SAORIRESULT_INTERNAL_SERVER_ERROR; }
+
+// ID 摜擾Akeep Ɋ܂܂Ȃ`ŕێĂ摜͒ʏ̉摜ɓWJ
+// ^CPʂ̉摜͓WJƑ傫ȃLoẌӖȂ̂ŁAΉĂȂ֐ɂ NULL Ԃ
+static image_entry *find_image_entry(int index, int keep)
+{
+    image_entry *entry = images.find(index);
+
+    if (entry == NULL || (entry->kind() & ~keep) == 0)
+    {
+        return entry;
+    }
+
+    if (entry->tiles)
+    {
+        return NULL;
+    }
+
+    image img;
+
+    if (entry->mask)
+    {
+        // }XN͍ƃAt@̉摜ɂȂ
+        if (!entry->mask->expand(img))
+        {
+            return NULL;
+        }
+
+        img.premultiplied(premultiplied_images);
+    }
+    else if (!entry->indexed->expand(img))
+    {
+        return NULL;
+    }
+
+    entry->frames.assign(1, std::move(img));
+    entry->mask.reset();
+    entry->indexed.reset();
+
+    images.update(*entry);
+
+    return entry;
+}
+
+// t@C̃VOl`𒲂ׂāAΉ郍[_[ŉ摜ǂݍ
+static bool decode_image_file(const string_t &file, const mapped_file &mapped, image &img)
+{
+    const unsigned char *data = mapped.data();
+
+    // BMP
+    if (mapped.size() >= 2 && data[0] == 'B' && data[1] == 'M')
+    {
+        return bmp_load_image(mapped, img);
+    }
+
+    // TGA ɂ̓VOl`̂ŁAPNG ȊO̓wb_؂Ĕ肷
+    static const unsigned char png_signature[] = { 0x89, 'P', 'N', 'G' };
+
+    if ((mapped.size() < 4 || memcmp(data, png_signature, 4) != 0) && tga_load_image(mapped, img))
+    {
+        return true;
+    }
+
+    // PNG
+    return png_load_image(file, img);
+}
+
+// 摜t@CǂݍށAǂݍݍς݂̃t@C̓sNZL
+static bool load_image_file(const string_t &file, image &img)
+{
+    mapped_file mapped;
+
+    // }bvłȂꍇ PNG Ƃēǂݍ
+    if (!mapped.open(file))
+    {
+        if (!png_load_image(file, img))
+        {
+            return false;
+        }
+
+        if (premultiplied_images)
+        {
+            img.premultiply();
+        }
+
+        return true;
+    }
+
+    // PNG ̓At@}XNꏏɓǂݍނ̂ŁA}XNύXꂽꍇǂݍݒ
+    size_t mask_size;
+    unsigned long long mask_modified;
+
+    get_file_stamp(png_mask_file(file), mask_size, mask_modified);
+
+    // ǂݍ񂾌ɕύXĂȂ΁AfR[hɋL
+    if (loaded_images.find(file, mapped.size(), mapped.modified(), mask_size, mask_modified, premultiplied_images, img))
+    {
+        return true;
+    }
+
+    if (!decode_image_file(file, mapped, img))
+    {
+        return false;
+    }
+
+    // ǂݍݎɈxϊ
+    if (premultiplied_images)
+    {
+        img.premultiply();
+    }
 
-#define GENERATE_IMAGE_INDEX(id) int id = static_cast<int>(images.size() + 1)
-#define VERIFY_IMAGE_INDEX(index) if (index < 1 || static_cast<int>(images.size()) < index) { return SAORIRESULT_BAD_REQUEST; }
+    loaded_images.insert(file, mapped.size(), mapped.modified(), mask_size, mask_modified, img);
+
+    return true;
+}
+
+// 摜t@CɑΉAt@}XN (PNA) 邩
+static bool has_mask_file(const string_t &file)
+{
+    FILE *fp;
+
+    if (tfopen_s(&fp, png_mask_file(file).c_str(), _T("rb")) != 0)
+    {
+        return false;
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+// SẴt@C 1  ID ̃t[Ƃēǂݍ
+static bool load_image_entry(const std::vector<string_t> &files, image_entry &entry)
+{
+    // 1 ̃pbg` PNG ́Aݒɂăpbĝ܂ܕێ
+    // At@}XN̓sNZɍ̂ŁAꍇ͓WJēǂݍ
+    if (indexed_images && files.size() == 1 && !has_mask_file(files[0]))
+    {
+        std::shared_ptr<indexed_image> indexed = std::make_shared<indexed_image>();
+
+        if (indexed->load(files[0]))
+        {
+            // pbgϊ΍ς
+            if (premultiplied_images)
+            {
+                indexed->premultiply();
+            }
+
+            entry.indexed = std::move(indexed);
+
+            return true;
+        }
+    }
+
+    entry.frames.resize(files.size());
+
+    for (std::vector<string_t>::size_type i = 0; i < files.size(); ++i)
+    {
+        if (!load_image_file(files[i], entry.frames[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// sNZPʂ̏sAZς݃At@̉摜̓Xg[gAt@ɖ߂ď
+// pbg摜̓pbg̐F
+template<class Image, class Function>
+static void transform_image(Image &img, Function f)
+{
+    if (img.premultiplied())
+    {
+        img.transform(straight_alpha_function<Function>(f));
+    }
+    else
+    {
+        img.transform(f);
+    }
+}
 
 // V摜쐬
 DEFINE_SAORI_FUNCTION(new)
@@ -30,14 +245,50 @@ DEFINE_SAORI_FUNCTION(new)
     int width = conv<int>(in.args[0]);
     int height = conv<int>(in.args[1]);
 
-    // C[W ID 𐶐
-    GENERATE_IMAGE_INDEX(id);
+    // 3 Ԗڂ̈w肳ꂽꍇ̓^CPʂŕێ
+    if (CHECK_ARGUMENT(3) && in.args[2] == _T("tiled"))
+    {
+        if (width <= 0 || height <= 0)
+        {
+            return SAORIRESULT_BAD_REQUEST;
+        }
+
+        image_entry entry;
+
+        // ^C͏܂܂ŊmۂȂ
+        entry.tiles = std::make_shared<tiled_image>(width, height);
+        entry.tiles->premultiplied(premultiplied_images);
+
+        INSERT_IMAGE_ENTRY(id, std::move(entry));
+
+        // C[W ID Ԃ
+        out.result = conv<string_t>(id);
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
+
+    image img;
+
+    if (CHECK_ARGUMENT(3) && in.args[2] == _T("mapped"))
+    {
+        // Ɏ܂Ȃ摜̂߂ɁAꎞt@CɃ}bvobt@ō쐬
+        if (!img.map(width, height))
+        {
+            return SAORIRESULT_BAD_REQUEST;
+        }
+    }
+    else
+    {
+        // V摜쐬
+        img = image(width, height);
+    }
 
-    // V摜쐬
-    std::unique_ptr<image> img(new image(width, height));
+    // ȉ摜͂ǂ̌`ł
+    img.premultiplied(premultiplied_images);
 
     // Xgɒǉ
-    images.insert(std::make_pair(id, std::move(img)));
+    INSERT_IMAGE_ENTRY(id, std::move(img));
 
     // C[W ID Ԃ
     out.result = conv<string_t>(id);
@@ -52,24 +303,19 @@ DEFINE_SAORI_FUNCTION(load)
     // ̌mF
     VERIFY_ARGUMENT(1);
 
-    // C[W ID 𐶐
-    GENERATE_IMAGE_INDEX(id);
+    // ǂoɓǂݍݒ悤Ƀt@Cێ
+    image_entry entry;
+    entry.files.assign(in.args.begin(), in.args.end());
 
-    for (auto it = in.args.cbegin(); it != in.args.cend(); ++it)
+    // t@Cǂݍ
+    if (!load_image_entry(entry.files, entry))
     {
-        // V摜쐬
-        std::unique_ptr<image> img(new image());
-
-        // t@Cǂݍ
-        if (!png_load_image(*it, *img))
-        {
-            return SAORIRESULT_BAD_REQUEST;
-        }
-
-        // Xgɒǉ
-        images.insert(std::make_pair(id, std::move(img)));
+        return SAORIRESULT_BAD_REQUEST;
     }
 
+    // SẴt[ǂݍ߂烊Xgɒǉ
+    INSERT_IMAGE_ENTRY(id, std::move(entry));
+
     // C[W ID Ԃ
     out.result = conv<string_t>(id);
 
@@ -87,19 +333,31 @@ DEFINE_SAORI_FUNCTION(save)
     int index = conv<int>(in.args[0]);
 
     // CfbNX
-    VERIFY_IMAGE_INDEX(index);
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_any);
 
-    int id = 1;
+    // ^CPʂ̉摜ƃ}XN͓WJ 1 so
+    if (entry->tiles)
+    {
+        return png_save_image(string_t(in.args[1]), *entry->tiles) ? SAORIRESULT_OK : SAORIRESULT_BAD_REQUEST;
+    }
+    if (entry->mask)
+    {
+        return png_save_image(string_t(in.args[1]), *entry->mask) ? SAORIRESULT_OK : SAORIRESULT_BAD_REQUEST;
+    }
+    if (entry->indexed)
+    {
+        return png_save_image(string_t(in.args[1]), *entry->indexed) ? SAORIRESULT_OK : SAORIRESULT_BAD_REQUEST;
+    }
 
-    auto range = images.equal_range(index);
+    std::vector<string_t>::size_type id = 1;
 
-    for (auto it = range.first; it != range.second; ++it)
+    for (auto it = entry->frames.cbegin(); it != entry->frames.cend() && id < in.args.size(); ++it)
     {
         // ۑ摜擾
-        image &img = *it->second;
+        const image &img = *it;
 
         // t@Cɏ
-        if (!png_save_image(in.args[id], img))
+        if (!png_save_image(string_t(in.args[id]), img))
         {
             return SAORIRESULT_BAD_REQUEST;
         }
@@ -116,6 +374,53 @@ DEFINE_SAORI_FUNCTION(clear)
 {
     // C[WׂĊJ
     images.clear();
+    loaded_images.clear();
+
+    // ԋp
+    trim_memory();
+
+    // 200 OK Ԃ
+    return SAORIRESULT_OK;
+}
+
+// w肵摜SẴt[Ƌɔj
+DEFINE_SAORI_FUNCTION(free)
+{
+    // ̌mF
+    VERIFY_ARGUMENT(1);
+
+    std::vector<int> indices;
+
+    // ɑSẴCfbNX؂
+    for (auto it = in.args.cbegin(); it != in.args.cend(); ++it)
+    {
+        int index = conv<int>(*it);
+
+        // CfbNX؁Aj邾Ȃ̂ŉ摜͓ǂݍݒȂ
+        if (!images.contains(index))
+        {
+            return SAORIRESULT_BAD_REQUEST;
+        }
+
+        indices.push_back(index);
+    }
+
+    int count = 0;
+
+    // C[WJ
+    for (auto it = indices.cbegin(); it != indices.cend(); ++it)
+    {
+        if (images.erase(*it))
+        {
+            count += 1;
+        }
+    }
+
+    // ԋp
+    trim_memory();
+
+    // JC[W̐Ԃ
+    out.result = conv<string_t>(count);
 
     // 200 OK Ԃ
     return SAORIRESULT_OK;
@@ -132,20 +437,57 @@ DEFINE_SAORI_FUNCTION(draw)
     int elem_index = conv<int>(in.args[1]);
 
     // CfbNXmF
-    VERIFY_IMAGE_INDEX(base_index);
-    VERIFY_IMAGE_INDEX(elem_index);
+    FIND_IMAGE_ENTRY_KEEP(base_entry, base_index, image_entry::kind_tiles);
 
-    // C[W擾
-    image &base = *images.lower_bound(base_index)->second;
-    image &elem = *images.lower_bound(elem_index)->second;
+    // }XNƃpbg摜͂̂܂ܕ`挳ɂ
+    FIND_IMAGE_ENTRY_KEEP(elem_entry, elem_index, image_entry::kind_mask | image_entry::kind_indexed);
+
+    // `͕ύX
+    base_entry->dirty = true;
 
     // ǉp[^擾
     int x = conv<int>(in.args[2]);
     int y = conv<int>(in.args[3]);
-    int opacity = CHECK_ARGUMENT(5) ? conv<int>(in.args[4]) : 100;
+    int opacity = (CHECK_ARGUMENT(5) || CHECK_ARGUMENT(6)) ? conv<int>(in.args[4]) : 100;
+
+    // }XN`悷FAȗꍇ͕sȍ
+    color fill_color = CHECK_ARGUMENT(6) ? color(conv<color::value_type>(in.args[5])) : color(255, 0, 0, 0);
+
+    bool drawn;
+
+    if (base_entry->tiles)
+    {
+        // ^CPʂ̉摜͏dȂ^Cɂ`悷
+        if (elem_entry->mask)
+        {
+            drawn = base_entry->tiles->draw(*elem_entry->mask, fill_color, x, y, opacity);
+        }
+        else if (elem_entry->indexed)
+        {
+            drawn = base_entry->tiles->draw(*elem_entry->indexed, x, y, opacity);
+        }
+        else
+        {
+            drawn = base_entry->tiles->draw(elem_entry->frames.front(), x, y, opacity);
+        }
 
-    // `悷
-    if (!draw_image(base, elem, x, y, opacity))
+        // mۂ^C̕vシ
+        images.update(*base_entry);
+    }
+    else if (elem_entry->mask)
+    {
+        drawn = draw_mask(base_entry->frames.front(), *elem_entry->mask, fill_color, x, y, opacity);
+    }
+    else if (elem_entry->indexed)
+    {
+        drawn = draw_indexed(base_entry->frames.front(), *elem_entry->indexed, x, y, opacity);
+    }
+    else
+    {
+        drawn = draw_image(base_entry->frames.front(), elem_entry->frames.front(), x, y, opacity);
+    }
+
+    if (!drawn)
     {
         return SAORIRESULT_BAD_REQUEST;
     }
@@ -163,17 +505,29 @@ DEFINE_SAORI_FUNCTION(fill)
     int index = conv<int>(in.args[0]);
 
     // CfbNXmF
-    VERIFY_IMAGE_INDEX(index);
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_tiles);
 
     // ǉp[^擾
     color fill_color(conv<color::value_type>(in.args[1]));
 
-    auto range = images.equal_range(index);
+    // C[W͕ύX
+    entry->dirty = true;
+
+    if (entry->tiles)
+    {
+        entry->tiles->fill(fill_color);
+
+        // mہA^C̕vサ
+        images.update(*entry);
 
-    for (auto it = range.first; it != range.second; ++it)
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
+
+    for (auto it = entry->frames.begin(); it != entry->frames.end(); ++it)
     {
         // C[W擾
-        image &img = *it->second;
+        image &img = *it;
 
         // hԂ
         fill_image(img, fill_color);
@@ -192,26 +546,71 @@ DEFINE_SAORI_FUNCTION(pixel)
     // C[W̃CfbNX擾
     int index = conv<int>(in.args[0]);
 
-    // CfbNX
-    VERIFY_IMAGE_INDEX(index);
-
-    // C[W擾
-    image &img = *images.lower_bound(index)->second;
+    // CfbNX؁Apbg摜͎擾邾ȂWJȂ
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_tiles | (CHECK_ARGUMENT(3) ? image_entry::kind_indexed : 0));
 
     // p[^擾
     int x = conv<int>(in.args[1]);
     int y = conv<int>(in.args[2]);
 
+    if (entry->indexed)
+    {
+        const indexed_image &indexed = *entry->indexed;
+
+        color value = indexed.premultiplied() ? unpremultiply_color(indexed.pixel(x, y)) : indexed.pixel(x, y);
+
+        out.result = conv<string_t>(value.to_rgb());
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
+
+    // ^CPʂ̉摜͊Y^CQƂ
+    if (entry->tiles)
+    {
+        tiled_image &tiles = *entry->tiles;
+
+        if (CHECK_ARGUMENT(3))
+        {
+            color value = tiles.premultiplied() ? unpremultiply_color(tiles.pixel(x, y)) : tiles.pixel(x, y);
+
+            out.result = conv<string_t>(value.to_rgb());
+        }
+        else
+        {
+            entry->dirty = true;
+
+            color value(conv<color::value_type>(in.args[3]));
+
+            tiles.pixel(tiles.premultiplied() ? premultiply_color(value) : value, x, y);
+
+            images.update(*entry);
+        }
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
+
+    // C[W擾
+    image &img = entry->frames.front();
+
     // ̐ɂċς
     if (CHECK_ARGUMENT(3))
     {
         // w肳ꂽW̃sNZl擾AԂ
-        out.result = conv<string_t>(img.pixel(x, y).to_rgb());
+        color value = img.premultiplied() ? unpremultiply_color(img.pixel(x, y)) : img.pixel(x, y);
+
+        out.result = conv<string_t>(value.to_rgb());
     }
     else
     {
+        // C[W͕ύX
+        entry->dirty = true;
+
+        color value(conv<color::value_type>(in.args[3]));
+
         // w肳ꂽW̃sNZlύX
-        img.pixel(color(conv<color::value_type>(in.args[3])), x, y);
+        img.pixel(img.premultiplied() ? premultiply_color(value) : value, x, y);
     }
 
     // 200 OK Ԃ
@@ -228,21 +627,28 @@ DEFINE_SAORI_FUNCTION(repaint)
     int index = conv<int>(in.args[0]);
 
     // CfbNX
-    VERIFY_IMAGE_INDEX(index);
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_indexed);
 
     // ϊOAϊ̐F擾
     color before(conv<color::value_type>(in.args[1]));
     color after(conv<color::value_type>(in.args[2]));
 
-    auto range = images.equal_range(index);
+    // C[W͕ύX
+    entry->dirty = true;
 
-    for (auto it = range.first; it != range.second; ++it)
+    for (auto it = entry->frames.begin(); it != entry->frames.end(); ++it)
     {
         // C[W擾
-        image &img = *it->second;
+        image &img = *it;
 
         // repaint_function s
-        img.transform(repaint_function(before, after));
+        transform_image(img, repaint_function(before, after));
+    }
+
+    // pbg摜̓pbg̐FύX
+    if (entry->indexed)
+    {
+        transform_image(*entry->indexed, repaint_function(before, after));
     }
 
     // 200 OK Ԃ
@@ -259,22 +665,29 @@ DEFINE_SAORI_FUNCTION(tone)
     int index = conv<int>(in.args[0]);
 
     // CfbNX
-    VERIFY_IMAGE_INDEX(index);
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_indexed);
 
     // ǉp[^擾
     int red = conv<int>(in.args[1]);
     int green = conv<int>(in.args[2]);
     int blue = conv<int>(in.args[3]);
 
-    auto range = images.equal_range(index);
+    // C[W͕ύX
+    entry->dirty = true;
 
-    for (auto it = range.first; it != range.second; ++it)
+    for (auto it = entry->frames.begin(); it != entry->frames.end(); ++it)
     {
         // C[W擾
-        image &img = *it->second;
+        image &img = *it;
 
         // tone_function s
-        img.transform(tone_function(red, green, blue));
+        transform_image(img, tone_function(red, green, blue));
+    }
+
+    // pbg摜̓pbg̐FύX
+    if (entry->indexed)
+    {
+        transform_image(*entry->indexed, tone_function(red, green, blue));
     }
 
     // 200 OK Ԃ
@@ -291,10 +704,7 @@ DEFINE_SAORI_FUNCTION(cut)
     int index = conv<int>(in.args[0]);
 
     // CfbNX
-    VERIFY_IMAGE_INDEX(index);
-
-    // C[W擾
-    image &src = *images.lower_bound(index)->second;
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_tiles | image_entry::kind_indexed);
 
     // ǉp[^擾
     int x = conv<int>(in.args[1]);
@@ -302,48 +712,174 @@ DEFINE_SAORI_FUNCTION(cut)
     int width = conv<int>(in.args[3]);
     int height = conv<int>(in.args[4]);
 
-    // C[W ID 𐶐
-    GENERATE_IMAGE_INDEX(id);
-
     // VC[W쐬
-    std::unique_ptr<image> dst(new image());
+    image dst;
+
+    // pbg摜͓pbĝ܂ܐ؂o
+    if (entry->indexed)
+    {
+        std::shared_ptr<indexed_image> indexed = std::make_shared<indexed_image>();
+
+        if (!entry->indexed->sub_image(*indexed, x, y, width, height))
+        {
+            return SAORIRESULT_BAD_REQUEST;
+        }
+
+        image_entry indexed_entry;
+        indexed_entry.indexed = std::move(indexed);
+
+        INSERT_IMAGE_ENTRY(id, std::move(indexed_entry));
+
+        // C[W ID Ԃ
+        out.result = conv<string_t>(id);
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
+
+    // ^CPʂ̉摜͐؂o͈͂̃^CW߂
+    if (entry->tiles)
+    {
+        if (!entry->tiles->sub_image(dst, x, y, width, height))
+        {
+            return SAORIRESULT_BAD_REQUEST;
+        }
+
+        INSERT_IMAGE_ENTRY(id, std::move(dst));
+
+        // C[W ID Ԃ
+        out.result = conv<string_t>(id);
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
+
+    // C[W擾
+    const image &src = entry->frames.front();
 
-    // 摜擾
-    if (!src.sub_image(*dst, x, y, width, height))
+    // ̉摜̃obt@QƂ镔摜쐬A܂ꂽ_ŃRs[
+    if (!src.view(dst, x, y, width, height))
     {
         return SAORIRESULT_BAD_REQUEST;
     }
 
     // Xgɒǉ
-    images.insert(std::make_pair(id, std::move(dst)));
+    INSERT_IMAGE_ENTRY(id, std::move(dst));
 
     // C[W ID Ԃ
-    out.result = conv<string_t>(images.size());
+    out.result = conv<string_t>(id);
 
     // 200 OK Ԃ
     return SAORIRESULT_OK;
 }
 
-// TCY
-DEFINE_SAORI_FUNCTION(resize)
+// TCY@烊TvOtB^擾
+static bool find_resample_filter(string_view_t method, resample_filter &filter)
 {
-    // ̌mF
-    VERIFY_ARGUMENT(3);
-
-    // C[W̃CfbNX擾
+    if (method == _T("ssp") || method == _T("nearest_neighbor"))
+    {
+        filter.support = 0.0;
+        filter.weight = point_filter;
+    }
+    else if (method == _T("fast") || method == _T("bilinear"))
+    {
+        filter.support = 1.0;
+        filter.weight = triangle_filter;
+    }
+    else if (method == _T("quality") || method == _T("bicubic"))
+    {
+        filter.support = 2.0;
+        filter.weight = cubic_filter;
+    }
+    else if (method == _T("lanczos2"))
+    {
+        filter.support = 2.0;
+        filter.weight = lanczos_filter<2>;
+    }
+    else if (method == _T("lanczos3"))
+    {
+        filter.support = 3.0;
+        filter.weight = lanczos_filter<3>;
+    }
+    else if (method == _T("lanczos4"))
+    {
+        filter.support = 4.0;
+        filter.weight = lanczos_filter<4>;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// TCY@ɑΉTv[ŁA`̑傫ɃTvO
+// src  image ̑ɁApbgʂĎQƂ indexed_image g
+template<class Source>
+static bool resample_image(const Source &src, image &dst, string_view_t method)
+{
+    if (method == _T("ssp") || method == _T("nearest_neighbor"))
+    {
+        // jAXglCo[
+        sample_image(src, dst, nearest_neighbor_sampler());
+    }
+    else if (method == _T("fast") || method == _T("bilinear"))
+    {
+        // oCjA
+        sample_image(src, dst, bilinear_sampler());
+    }
+    else if (method == _T("quality") || method == _T("bicubic"))
+    {
+        // oCL[rbN
+        sample_image(src, dst, bicubic_sampler());
+    }
+    else if (method == _T("lanczos2"))
+    {
+        // Lanczos-2
+        sample_image(src, dst, lanczos2_sampler());
+    }
+    else if (method == _T("lanczos3"))
+    {
+        // Lanczos-3
+        sample_image(src, dst, lanczos3_sampler());
+    }
+    else if (method == _T("lanczos4"))
+    {
+        // Lanczos-4
+        sample_image(src, dst, lanczos4_sampler());
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// TCY
+DEFINE_SAORI_FUNCTION(resize)
+{
+    // ̌mF
+    VERIFY_ARGUMENT(3);
+
+    // C[W̃CfbNX擾
     int index = conv<int>(in.args[0]);
 
     // CfbNX
-    VERIFY_IMAGE_INDEX(index);
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_indexed | image_entry::kind_tiles);
 
-    // C[W擾
-    image &src = *images.lower_bound(index)->second;
+    // C[W擾Apbg摜͓WJɃpbgʂăTvO
+    const tiled_image *tiles = entry->tiles.get();
+    const indexed_image *indexed = entry->indexed.get();
+    const image *frame = tiles == NULL && indexed == NULL ? &entry->frames.front() : NULL;
+
+    int src_width = tiles != NULL ? tiles->width() : indexed != NULL ? indexed->width() : frame->width();
+    int src_height = tiles != NULL ? tiles->height() : indexed != NULL ? indexed->height() : frame->height();
 
     int width;
     int height;
 
     // ǉp[^擾
-    const string_t &method = in.args[1];
+    string_view_t method = in.args[1];
 
     // ̐ɂċς
     if (CHECK_ARGUMENT(3))
@@ -352,8 +888,8 @@ DEFINE_SAORI_FUNCTION(resize)
         double scale = conv<double>(in.args[2]);
 
         // XP[ɃTCY
-        width = static_cast<int>(src.width() * scale / 100.0);
-        height = static_cast<int>(src.height() * scale / 100.0);
+        width = static_cast<int>(src_width * scale / 100.0);
+        height = static_cast<int>(src_height * scale / 100.0);
     }
     else
     {
@@ -364,11 +900,11 @@ DEFINE_SAORI_FUNCTION(resize)
         // ЕŒ̏ꍇ́A䗦ۂ܂܃TCY
         if (width == 0)
         {
-            width = static_cast<int>(src.width() * (static_cast<double>(height) / src.height()));
+            width = static_cast<int>(src_width * (static_cast<double>(height) / src_height));
         }
         else if (height == 0)
         {
-            height = static_cast<int>(src.height() * (static_cast<double>(width) / src.width()));
+            height = static_cast<int>(src_height * (static_cast<double>(width) / src_width));
         }
     }
 
@@ -378,59 +914,83 @@ DEFINE_SAORI_FUNCTION(resize)
         return SAORIRESULT_BAD_REQUEST;
     }
 
-    // C[W ID 𐶐
-    GENERATE_IMAGE_INDEX(id);
+    // ^CPʂ̉摜́A^CPʂ̂܂܃^CɃTvO
+    if (tiles != NULL)
+    {
+        resample_filter filter;
 
-    // VC[W쐬AXgɒǉ
-    std::unique_ptr<image> dst(new image(width, height));
+        if (!find_resample_filter(method, filter))
+        {
+            return SAORIRESULT_BAD_REQUEST;
+        }
 
-    if (src.width() == width && src.height() == height)
-    {
-        memcpy(dst->buffer(), src.buffer(), width * height * sizeof(color));
+        image_entry tiled_entry;
+        tiled_entry.tiles = std::make_shared<tiled_image>(width, height);
+        tiled_entry.tiles->premultiplied(tiles->premultiplied());
+
+        resample_tiles(*tiles, *tiled_entry.tiles, filter);
+
+        INSERT_IMAGE_ENTRY(id, std::move(tiled_entry));
+
+        // C[W ID Ԃ
+        out.result = conv<string_t>(id);
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
     }
-    else
+
+    // VC[W쐬AXgɒǉ
+    image dst;
+
+    if (src_width == width && src_height == height)
     {
-        // TCY摜擾
-        if (method == _T("ssp") || method == _T("nearest_neighbor"))
+        // TCY̏ꍇ̓obt@LApbg摜͓WJ邾ōς
+        if (frame != NULL)
         {
-            // jAXglCo[
-            src.resize(*dst, nearest_neighbor_sampler());
+            dst = *frame;
         }
-        else if (method == _T("fast") || method == _T("bilinear"))
+        else if (!indexed->expand(dst))
         {
-            // oCjA
-            src.resize(*dst, bilinear_sampler());
+            return SAORIRESULT_BAD_REQUEST;
         }
-        else if (method == _T("quality") || method == _T("bicubic"))
+    }
+    else
+    {
+        // SẴsNZTv[ނ̂ŏȂ
+        if (!dst.resize(width, height, false))
         {
-            // oCL[rbN
-            src.resize(*dst, bicubic_sampler());
+            return SAORIRESULT_BAD_REQUEST;
         }
-        else if (method == _T("lanczos2"))
+        dst.premultiplied(indexed != NULL ? indexed->premultiplied() : frame->premultiplied());
+
+        // TCY摜擾
+        // Ԃꍇ́A`lɕsNZ𐅕ƐɕăTvO
+        // pbg摜ƃjAXglCo[͕ԂȂ̂ŁATv[ŃsNZEɂ
+        resample_filter filter;
+
+        if (!find_resample_filter(method, filter))
         {
-            // Lanczos-2
-            src.resize(*dst, lanczos2_sampler());
+            return SAORIRESULT_BAD_REQUEST;
         }
-        else if (method == _T("lanczos3"))
+
+        if (indexed != NULL)
         {
-            // Lanczos-3
-            src.resize(*dst, lanczos3_sampler());
+            resample_image(*indexed, dst, method);
         }
-        else if (method == _T("lanczos4"))
+        else if (filter.support <= 0.0)
         {
-            // Lanczos-4
-            src.resize(*dst, lanczos4_sampler());
+            resample_image(*frame, dst, method);
         }
         else
         {
-            return SAORIRESULT_BAD_REQUEST;
+            resample_planar(*frame, dst, filter);
         }
     }
 
-    images.insert(std::make_pair(id, std::move(dst)));
+    INSERT_IMAGE_ENTRY(id, std::move(dst));
 
     // C[W ID Ԃ
-    out.result = conv<string_t>(images.size());
+    out.result = conv<string_t>(id);
 
     // 200 OK Ԃ
     return SAORIRESULT_OK;
@@ -446,17 +1006,32 @@ DEFINE_SAORI_FUNCTION(size)
     int index = conv<int>(in.args[0]);
 
     // CfbNX
-    VERIFY_IMAGE_INDEX(index);
-
-    // C[W擾
-    const image &img = *images.lower_bound(index)->second;
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_any);
 
     // C[W ID Ԃ
     out.result = conv<string_t>(index);
 
     // ǉƂĕƍԂ
-    out.values.push_back(conv<string_t>(img.width()));
-    out.values.push_back(conv<string_t>(img.height()));
+    if (entry->tiles)
+    {
+        out.values.push_back(conv<string_t>(entry->tiles->width()));
+        out.values.push_back(conv<string_t>(entry->tiles->height()));
+    }
+    else if (entry->mask)
+    {
+        out.values.push_back(conv<string_t>(entry->mask->width()));
+        out.values.push_back(conv<string_t>(entry->mask->height()));
+    }
+    else if (entry->indexed)
+    {
+        out.values.push_back(conv<string_t>(entry->indexed->width()));
+        out.values.push_back(conv<string_t>(entry->indexed->height()));
+    }
+    else
+    {
+        out.values.push_back(conv<string_t>(entry->frames.front().width()));
+        out.values.push_back(conv<string_t>(entry->frames.front().height()));
+    }
 
     // 200 OK Ԃ
     return SAORIRESULT_OK;
@@ -476,20 +1051,27 @@ DEFINE_SAORI_FUNCTION(opacity)
     int index = conv<int>(in.args[0]);
 
     // CfbNX
-    VERIFY_IMAGE_INDEX(index);
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_indexed);
 
     // x擾
     int opacity = conv<int>(in.args[1]);
 
-    auto range = images.equal_range(index);
+    // C[W͕ύX
+    entry->dirty = true;
 
-    for (auto it = range.first; it != range.second; ++it)
+    for (auto it = entry->frames.begin(); it != entry->frames.end(); ++it)
     {
         // C[W擾
-        image &img = *it->second;
+        image &img = *it;
 
         // opacity_function s
-        img.transform(opacity_function(opacity));
+        transform_image(img, opacity_function(opacity));
+    }
+
+    // pbg摜̓pbg̐FύX
+    if (entry->indexed)
+    {
+        transform_image(*entry->indexed, opacity_function(opacity));
     }
 
     // 200 OK Ԃ
@@ -505,56 +1087,832 @@ DEFINE_SAORI_FUNCTION(dup)
     int index = conv<int>(in.args[0]);
 
     // CfbNX
-    VERIFY_IMAGE_INDEX(index);
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_any);
+
+    // }XN͕ύXȂ̂ł̂܂܋L
+    if (entry->mask)
+    {
+        image_entry mask_entry;
+        mask_entry.mask = entry->mask;
+
+        INSERT_IMAGE_ENTRY(id, std::move(mask_entry));
+
+        // C[W ID Ԃ
+        out.result = conv<string_t>(id);
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
+
+    // ^CPʂ̉摜̓^C̃obt@LĕA܂ꂽ^CRs[
+    if (entry->tiles)
+    {
+        image_entry tiled_entry;
+        tiled_entry.tiles = std::make_shared<tiled_image>(*entry->tiles);
+
+        INSERT_IMAGE_ENTRY(id, std::move(tiled_entry));
+
+        // C[W ID Ԃ
+        out.result = conv<string_t>(id);
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
+
+    // pbg摜͔ԍLApbg𕡐
+    if (entry->indexed)
+    {
+        image_entry indexed_entry;
+        indexed_entry.indexed = std::make_shared<indexed_image>(*entry->indexed);
+
+        INSERT_IMAGE_ENTRY(id, std::move(indexed_entry));
+
+        // C[W ID Ԃ
+        out.result = conv<string_t>(id);
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
+
+    // ʏ̉摜ƂĎ擾
+    entry = find_image_entry(index, 0);
+
+    if (entry == NULL)
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // obt@LĕAύXꂽ_ŃRs[
+    image newimg(entry->frames.front());
+
+    // Xgɒǉ
+    INSERT_IMAGE_ENTRY(id, std::move(newimg));
+
+    // C[W ID Ԃ
+    out.result = conv<string_t>(id);
+
+    // 200 OK Ԃ
+    return SAORIRESULT_OK;
+}
+
+// ڂ摜쐬
+DEFINE_SAORI_FUNCTION(blur)
+{
+    // ̌mF
+    VERIFY_ARGUMENT(2);
+
+    // C[W̃CfbNX擾
+    int index = conv<int>(in.args[0]);
+
+    // CfbNX
+    FIND_IMAGE_ENTRY_KEEP(entry, index, image_entry::kind_tiles);
+
+    // a擾
+    int radius = conv<int>(in.args[1]);
+
+    if (radius < 0)
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // ^CPʂ̉摜́A^CɎ͂܂߂Đ؂oĂڂ
+    if (entry->tiles)
+    {
+        const tiled_image &tiles = *entry->tiles;
+
+        // 摜傫Ȕa͈Ӗ
+        radius = std::min(radius, std::max(tiles.width(), tiles.height()));
+
+        image_entry tiled_entry;
+        tiled_entry.tiles = std::make_shared<tiled_image>(tiles.width(), tiles.height());
+        tiled_entry.tiles->premultiplied(tiles.premultiplied());
+
+        blur_tiles(tiles, *tiled_entry.tiles, radius);
+
+        INSERT_IMAGE_ENTRY(id, std::move(tiled_entry));
+
+        // C[W ID Ԃ
+        out.result = conv<string_t>(id);
+
+        // 200 OK Ԃ
+        return SAORIRESULT_OK;
+    }
 
     // C[W擾
-    image &img = *images.lower_bound(index)->second;
+    const image &src = entry->frames.front();
+
+    // 摜傫Ȕa͈Ӗ
+    radius = std::min(radius, std::max(src.width(), src.height()));
+
+    // VC[W쐬
+    image dst;
 
-    // 摜̃TCY擾
-    int width = img.width();
-    int height = img.height();
+    blur_image(src, dst, radius);
 
-    // C[W ID 𐶐
-    GENERATE_IMAGE_INDEX(id);
+    // Xgɒǉ
+    INSERT_IMAGE_ENTRY(id, std::move(dst));
 
-    // V摜쐬
-    std::unique_ptr<image> newimg(new image(width, height));
+    // C[W ID Ԃ
+    out.result = conv<string_t>(id);
 
-    // 摜Rs[
-    memcpy(newimg->buffer(), img.buffer(), width * height * sizeof(color));
+    // 200 OK Ԃ
+    return SAORIRESULT_OK;
+}
+
+// 摜̃At@`l}XN쐬
+DEFINE_SAORI_FUNCTION(mask)
+{
+    // ̌mF
+    VERIFY_ARGUMENT(1);
+
+    // C[W̃CfbNX擾
+    int index = conv<int>(in.args[0]);
+
+    // CfbNX
+    FIND_IMAGE_ENTRY(entry, index);
+
+    // V}XN쐬
+    std::shared_ptr<alpha_mask> mask = std::make_shared<alpha_mask>();
+
+    if (!mask->assign(entry->frames.front()))
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    image_entry mask_entry;
+    mask_entry.mask = std::move(mask);
 
     // Xgɒǉ
-    images.insert(std::make_pair(id, std::move(newimg)));
+    INSERT_IMAGE_ENTRY(id, std::move(mask_entry));
 
     // C[W ID Ԃ
-    out.result = conv<string_t>(images.size());
+    out.result = conv<string_t>(id);
+
+    // 200 OK Ԃ
+    return SAORIRESULT_OK;
+}
+
+// }XNŉ摜؂蔲
+DEFINE_SAORI_FUNCTION(clip)
+{
+    // ̌mFAʒu X  Y 𗼕w肷
+    VERIFY_ARGUMENT_RANGE(2, 4);
+
+    if (CHECK_ARGUMENT(3))
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // C[W̃CfbNX擾
+    int index = conv<int>(in.args[0]);
+    int mask_index = conv<int>(in.args[1]);
+
+    // CfbNXmF
+    FIND_IMAGE_ENTRY(entry, index);
+    FIND_IMAGE_ENTRY_KEEP(mask_entry, mask_index, image_entry::kind_any);
+
+    // }XNȊO͎włȂ
+    if (!mask_entry->mask)
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // }XNuʒuAȗꍇ͍ɑ
+    int x = CHECK_ARGUMENT(4) ? conv<int>(in.args[2]) : 0;
+    int y = CHECK_ARGUMENT(4) ? conv<int>(in.args[3]) : 0;
+
+    // C[W͕ύX
+    entry->dirty = true;
+
+    for (auto it = entry->frames.begin(); it != entry->frames.end(); ++it)
+    {
+        clip_image(*it, *mask_entry->mask, x, y);
+    }
+
+    // 200 OK Ԃ
+    return SAORIRESULT_OK;
+}
+
+// ؂蕶ŕ
+static std::vector<string_view_t> split_argument(string_view_t arg, char_t delimiter)
+{
+    std::vector<string_view_t> result;
+
+    string_view_t::size_type begin = 0;
+    string_view_t::size_type end;
+
+    while ((end = arg.find(delimiter, begin)) != string_view_t::npos)
+    {
+        result.push_back(arg.substr(begin, end - begin));
+        begin = end + 1;
+    }
+
+    result.push_back(arg.substr(begin));
+
+    return result;
+}
+
+// "tone,r,g,b" `̎w肩sPʂ̕ϊ֐쐬
+static bool parse_row_transform(string_view_t spec, row_transform &transform)
+{
+    std::vector<string_view_t> params = split_argument(spec, _T(','));
+
+    string_view_t name = params[0];
+
+    if (name == _T("tone") && params.size() == 4)
+    {
+        transform = make_row_transform(tone_function(conv<int>(params[1]), conv<int>(params[2]), conv<int>(params[3])));
+    }
+    else if (name == _T("opacity") && params.size() == 2)
+    {
+        transform = make_row_transform(opacity_function(conv<int>(params[1])));
+    }
+    else if (name == _T("repaint") && params.size() == 3)
+    {
+        transform = make_row_transform(repaint_function(color(conv<color::value_type>(params[1])), color(conv<color::value_type>(params[2]))));
+    }
+    else if (name == _T("trans") && params.size() == 2)
+    {
+        transform = make_row_transform(trans_function(color(conv<color::value_type>(params[1]))));
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// 摜t@C 1 sϊďo
+static bool convert_file(const string_t &src, const string_t &dst, int &width, int &height, const resample_filter &filter, const row_transform &transform, stream_scratch &scratch)
+{
+    // ϊJ
+    png_reader reader;
+
+    if (!reader.open(src))
+    {
+        return false;
+    }
+
+    // At@}XNΈꏏɓǂݍ
+    reader.open_mask(png_mask_file(src));
+
+    // Е 0 ̏ꍇ́A䗦ۂ܂܃TCY
+    if (width == 0 && height == 0)
+    {
+        width = reader.width();
+        height = reader.height();
+    }
+    else if (width == 0)
+    {
+        width = static_cast<int>(reader.width() * (static_cast<double>(height) / reader.height()));
+    }
+    else if (height == 0)
+    {
+        height = static_cast<int>(reader.height() * (static_cast<double>(width) / reader.width()));
+    }
+
+    // ϊJ
+    png_writer writer;
+
+    if (!writer.open(dst, width, height))
+    {
+        return false;
+    }
+
+    // 1 sϊArŎsꍇ͏̃t@CcȂ
+    bool converted = false;
+
+    try
+    {
+        converted = stream_convert(reader, writer, width, height, filter, transform, scratch) && writer.close();
+    }
+    catch (...)
+    {
+        writer.close();
+        tremove(dst.c_str());
+        throw;
+    }
+
+    if (!converted)
+    {
+        writer.close();
+        tremove(dst.c_str());
+    }
+
+    return converted;
+}
+
+// 摜t@CϊȂʂ̃t@Cɏo
+DEFINE_SAORI_FUNCTION(convert)
+{
+    // ̌mF
+    VERIFY_ARGUMENT(5);
+
+    // ǉp[^擾
+    string_view_t method = in.args[2];
+    int width = conv<int>(in.args[3]);
+    int height = conv<int>(in.args[4]);
+
+    // TvOtB^擾
+    resample_filter filter;
+
+    if (!find_resample_filter(method, filter))
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // 6 Ԗڈȍ~̈ϊ֐쐬
+    std::vector<row_transform> transforms;
+
+    for (std::vector<string_t>::size_type i = 5; i < in.args.size(); ++i)
+    {
+        row_transform transform;
+
+        if (!parse_row_transform(in.args[i], transform))
+        {
+            return SAORIRESULT_BAD_REQUEST;
+        }
+
+        transforms.push_back(transform);
+    }
+
+    // ϊ֐܂Ƃ߂
+    row_transform transform;
+
+    if (!transforms.empty())
+    {
+        transform = [&transforms](color *pixels, int length)
+        {
+            for (auto it = transforms.cbegin(); it != transforms.cend(); ++it)
+            {
+                (*it)(pixels, length);
+            }
+        };
+    }
+
+    // 1 sϊ
+    stream_scratch scratch;
+
+    if (!convert_file(string_t(in.args[0]), string_t(in.args[1]), width, height, filter, transform, scratch))
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // ǉƂĕƍԂ
+    out.values.push_back(conv<string_t>(width));
+    out.values.push_back(conv<string_t>(height));
+
+    // 200 OK Ԃ
+    return SAORIRESULT_OK;
+}
+
+// ̉摜t@C̃TlCɍ쐬
+DEFINE_SAORI_FUNCTION(thumbnail)
+{
+    // ̌mF
+    VERIFY_ARGUMENT(5);
+
+    // ϊƕϊ͕K΂ɂȂ
+    if ((in.args.size() - 3) % 2 != 0)
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // ǉp[^擾
+    string_view_t method = in.args[0];
+    int width = conv<int>(in.args[1]);
+    int height = conv<int>(in.args[2]);
+
+    // TvOtB^擾
+    resample_filter filter;
+
+    if (!find_resample_filter(method, filter))
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // [J[v[͏ɍ쐬Ďg
+    {
+        std::lock_guard<std::mutex> lock(workers_mutex);
+
+        if (!workers)
+        {
+            workers.reset(new worker_pool());
+            worker_scratches.resize(workers->size());
+        }
+    }
+
+    int count = static_cast<int>(in.args.size() - 3) / 2;
+
+    std::vector<SAORIResult> results(count, SAORIRESULT_BAD_REQUEST);
+
+    // v[͑̌ĂяoƂLĂ̂ŁǍĂяõ^XN𐔂
+    task_latch latch(count);
+
+    // t@CɃ^XN𓊓
+    for (int i = 0; i < count; ++i)
+    {
+        workers->post([&, i](int worker)
+        {
+            int dst_width = width;
+            int dst_height = height;
+
+            // Ɨ̈̓[J[Ɏg
+            // O̓[J[̃XbhOɏoÃt@C 500 ƂĕԂ
+            try
+            {
+                if (convert_file(string_t(in.args[i * 2 + 3]), string_t(in.args[i * 2 + 4]), dst_width, dst_height, filter, row_transform(), worker_scratches[worker]))
+                {
+                    results[i] = SAORIRESULT_OK;
+                }
+            }
+            catch (...)
+            {
+                results[i] = SAORIRESULT_INTERNAL_SERVER_ERROR;
+            }
+
+            latch.count_down();
+        });
+    }
+
+    // SẴt@C̏I܂ő҂
+    latch.wait();
+
+    int succeeded = 0;
+
+    // t@ČʂǉƂĕԂ
+    for (int i = 0; i < count; ++i)
+    {
+        if (results[i] == SAORIRESULT_OK)
+        {
+            succeeded += 1;
+        }
+
+        out.values.push_back(conv<string_t>(static_cast<int>(results[i])));
+    }
+
+    // t@CԂ
+    out.result = conv<string_t>(succeeded);
 
     // 200 OK Ԃ
     return SAORIRESULT_OK;
 }
 
+// ݒ擾AύX
+DEFINE_SAORI_FUNCTION(config)
+{
+    // ̌mF
+    VERIFY_ARGUMENT_RANGE(1, 2);
+
+    // ݒ̖O擾
+    string_view_t name = in.args[0];
+
+    if (name == _T("budget"))
+    {
+        // 摜̃ (oCg)A0 ̏ꍇ͖
+        if (CHECK_ARGUMENT(2))
+        {
+            images.budget(conv<size_t>(in.args[1]));
+        }
+
+        out.result = conv<string_t>(images.budget());
+
+        // ǉƂČ݂̎gpʂԂ
+        out.values.push_back(conv<string_t>(images.usage()));
+    }
+    else if (name == _T("pool"))
+    {
+        // g񂷂߂ɕێobt@̏ (oCg)A0 ̏ꍇ͎g񂳂Ȃ
+        if (CHECK_ARGUMENT(2))
+        {
+            buffer_pool::instance().limit(conv<size_t>(in.args[1]));
+        }
+
+        out.result = conv<string_t>(buffer_pool::instance().limit());
+
+        // ǉƂČݕێĂTCYԂ
+        out.values.push_back(conv<string_t>(buffer_pool::instance().cached()));
+    }
+    else if (name == _T("premultiplied"))
+    {
+        // ȌɓǂݍށA쐬摜Zς݃At@ŕێ邩
+        if (CHECK_ARGUMENT(2))
+        {
+            premultiplied_images = conv<int>(in.args[1]) != 0;
+        }
+
+        out.result = conv<string_t>(premultiplied_images ? 1 : 0);
+    }
+    else if (name == _T("indexed"))
+    {
+        // Ȍɓǂݍރpbg` PNG pbĝ܂ܕێ邩
+        if (CHECK_ARGUMENT(2))
+        {
+            indexed_images = conv<int>(in.args[1]) != 0;
+        }
+
+        out.result = conv<string_t>(indexed_images ? 1 : 0);
+    }
+    else if (name == _T("scratch"))
+    {
+        // t@CɃ}bv摜쐬fBNgȀꍇ͈ꎞfBNgg
+        if (CHECK_ARGUMENT(2))
+        {
+            image::scratch_directory(string_t(in.args[1]));
+        }
+
+        out.result = image::scratch_directory();
+    }
+    else if (name == _T("hugepage"))
+    {
+        // Huge Page g摜obt@̍ŏTCY (oCg)A0 ̏ꍇ͎gȂ
+        if (CHECK_ARGUMENT(2))
+        {
+            buffer_pool::instance().hugepage_threshold(conv<size_t>(in.args[1]));
+        }
+
+        out.result = conv<string_t>(buffer_pool::instance().hugepage_threshold());
+
+        // ǉƂ Huge Page gĂTCYԂ
+        out.values.push_back(conv<string_t>(buffer_pool::instance().hugepage_bytes()));
+    }
+    else if (name == _T("compress"))
+    {
+        // ANZXĂȂ摜k܂ł̎ (b)A0 ̏ꍇ͈kȂ
+        if (CHECK_ARGUMENT(2))
+        {
+            compress_timeout = conv<unsigned long long>(in.args[1]);
+        }
+
+        out.result = conv<string_t>(compress_timeout.load());
+    }
+    else
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // 200 OK Ԃ
+    return SAORIRESULT_OK;
+}
+
+// v擾
+DEFINE_SAORI_FUNCTION(stats)
+{
+    // ̌mF
+    VERIFY_ARGUMENT(1);
+
+    // v̖O擾
+    string_view_t name = in.args[0];
+
+    if (name == _T("images"))
+    {
+        // ێĂ摜̐
+        out.result = conv<string_t>(images.size());
+    }
+    else if (name == _T("usage"))
+    {
+        // 摜gpĂ郁
+        out.result = conv<string_t>(images.usage());
+    }
+    else if (name == _T("pool"))
+    {
+        // g񂷂߂ɕێĂobt@̃TCY
+        out.result = conv<string_t>(buffer_pool::instance().cached());
+    }
+    else if (name == _T("hugepage"))
+    {
+        // Huge Page g悤Ɋmۂgp̃obt@̃TCY
+        out.result = conv<string_t>(buffer_pool::instance().hugepage_bytes());
+    }
+    else if (name == _T("compressed"))
+    {
+        // kɂČĂ郁
+        out.result = conv<string_t>(images.saved());
+    }
+    else if (name == _T("inflate"))
+    {
+        // k摜WJ
+        out.result = conv<string_t>(images.inflated());
+
+        // ǉƂēWJɂvԂƍő厞 (}CNb) Ԃ
+        out.values.push_back(conv<string_t>(images.inflate_time()));
+        out.values.push_back(conv<string_t>(images.inflate_max()));
+    }
+    else
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    // 200 OK Ԃ
+    return SAORIRESULT_OK;
+}
+
+// ֐̉摜 ID 󂯎̈ʒu (rbg)Aɖ֐͉摜󂯎Ȃ
+// Ăяo͂̉摜gpɂāÃXbȟĂяo
+static const unsigned int all_image_arguments = ~0u;
+
+static const struct
+{
+    const char_t *function;
+    unsigned int positions;
+} image_arguments[] =
+{
+    { _T("save"), 1u << 0 },
+    { _T("free"), all_image_arguments },
+    { _T("draw"), (1u << 0) | (1u << 1) },
+    { _T("fill"), 1u << 0 },
+    { _T("pixel"), 1u << 0 },
+    { _T("repaint"), 1u << 0 },
+    { _T("tone"), 1u << 0 },
+    { _T("cut"), 1u << 0 },
+    { _T("resize"), 1u << 0 },
+    { _T("size"), 1u << 0 },
+    { _T("rotate"), 1u << 0 },
+    { _T("opacity"), 1u << 0 },
+    { _T("dup"), 1u << 0 },
+    { _T("blur"), 1u << 0 },
+    { _T("mask"), 1u << 0 },
+    { _T("clip"), (1u << 0) | (1u << 1) },
+};
+
+// SAORI ֐̈ꗗ
+#define COLORS_FUNCTIONS(REGISTER_SAORI_FUNCTION) \
+    REGISTER_SAORI_FUNCTION(new) \
+    REGISTER_SAORI_FUNCTION(load) \
+    REGISTER_SAORI_FUNCTION(save) \
+    REGISTER_SAORI_FUNCTION(clear) \
+    REGISTER_SAORI_FUNCTION(free) \
+    REGISTER_SAORI_FUNCTION(draw) \
+    REGISTER_SAORI_FUNCTION(fill) \
+    REGISTER_SAORI_FUNCTION(pixel) \
+    REGISTER_SAORI_FUNCTION(repaint) \
+    REGISTER_SAORI_FUNCTION(tone) \
+    REGISTER_SAORI_FUNCTION(cut) \
+    REGISTER_SAORI_FUNCTION(resize) \
+    REGISTER_SAORI_FUNCTION(size) \
+    REGISTER_SAORI_FUNCTION(rotate) \
+    REGISTER_SAORI_FUNCTION(opacity) \
+    REGISTER_SAORI_FUNCTION(dup) \
+    REGISTER_SAORI_FUNCTION(blur) \
+    REGISTER_SAORI_FUNCTION(mask) \
+    REGISTER_SAORI_FUNCTION(clip) \
+    REGISTER_SAORI_FUNCTION(convert) \
+    REGISTER_SAORI_FUNCTION(thumbnail) \
+    REGISTER_SAORI_FUNCTION(config) \
+    REGISTER_SAORI_FUNCTION(stats)
+
 bool saori::load()
 {
+    // ǂo摜̓ǂݍ݂Ɏg
+    images.loader(load_image_entry);
+
     // SAORI ֐o^
-    REGISTER_SAORI_FUNCTION(new);
-    REGISTER_SAORI_FUNCTION(load);
-    REGISTER_SAORI_FUNCTION(save);
-    REGISTER_SAORI_FUNCTION(clear);
-    REGISTER_SAORI_FUNCTION(draw);
-    REGISTER_SAORI_FUNCTION(fill);
-    REGISTER_SAORI_FUNCTION(pixel);
-    REGISTER_SAORI_FUNCTION(repaint);
-    REGISTER_SAORI_FUNCTION(tone);
-    REGISTER_SAORI_FUNCTION(cut);
-    REGISTER_SAORI_FUNCTION(resize);
-    REGISTER_SAORI_FUNCTION(size);
-    REGISTER_SAORI_FUNCTION(rotate);
-    REGISTER_SAORI_FUNCTION(opacity);
-    REGISTER_SAORI_FUNCTION(dup);
+    REGISTER_SAORI_FUNCTIONS(COLORS_FUNCTIONS);
+
     return true;
 }
 
+// kI摜𔽉fāAVɃANZXȂȂ摜k
+static void compress_idle_images()
+{
+    std::vector<std::shared_ptr<compress_job>> finished;
+
+    {
+        std::lock_guard<std::mutex> lock(compressed_jobs_mutex);
+        finished.swap(compressed_jobs);
+    }
+
+    for (auto it = finished.begin(); it != finished.end(); ++it)
+    {
+        images.commit(**it);
+    }
+
+    if (compress_timeout == 0)
+    {
+        return;
+    }
+
+    // ǂݍ񂾂̉摜̓LbVƃobt@LĂ邪Ak trim ŃLbVO
+    std::vector<compress_job> jobs = images.idle(compress_timeout * 1000, [](const image &frame)
+    {
+        return loaded_images.holds(frame);
+    });
+
+    if (jobs.empty())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(workers_mutex);
+
+        if (!compressor)
+        {
+            compressor.reset(new worker_pool(1));
+        }
+    }
+
+    for (auto it = jobs.begin(); it != jobs.end(); ++it)
+    {
+        std::shared_ptr<compress_job> job = std::make_shared<compress_job>(std::move(*it));
+
+        compressor->post([job](int)
+        {
+            if (compress_cancelled)
+            {
+                return;
+            }
+
+            // O͈k̎sƂĈÃt[c
+            try
+            {
+                job->run(compress_cancelled);
+            }
+            catch (...)
+            {
+                job->frames.clear();
+                job->compressed.clear();
+                job->succeeded = false;
+            }
+
+            std::lock_guard<std::mutex> lock(compressed_jobs_mutex);
+            compressed_jobs.push_back(job);
+        });
+    }
+}
+
+void saori::idle()
+{
+    compress_idle_images();
+
+    // ݂ŕꂽA͉ꂽ摜̓ǂݍ݌ʂ
+    loaded_images.trim();
+
+    // 𒴂ĂΉ摜ǂo
+    if (images.evict() > 0)
+    {
+        loaded_images.trim();
+        trim_memory();
+    }
+}
+
+void saori::enter(const saori_input &in)
+{
+    // 摜 ID 󂯎A܂Ƃ߂Ďgpɂ
+    // 摜gĂяoǍĂяoÎ҂ƂɂȂ
+    std::vector<int> ids;
+
+    for (auto spec = std::begin(image_arguments); spec != std::end(image_arguments); ++spec)
+    {
+        if (in.function != spec->function)
+        {
+            continue;
+        }
+
+        for (std::vector<string_view_t>::size_type i = 0; i < in.args.size(); ++i)
+        {
+            if (spec->positions != all_image_arguments && (i >= 32 || (spec->positions & (1u << i)) == 0))
+            {
+                continue;
+            }
+
+            // lƂēǂ߂Ȃ́A֐̒ 400 ɂȂ
+            try
+            {
+                ids.push_back(conv<int>(in.args[i]));
+            }
+            catch (...)
+            {
+            }
+        }
+        break;
+    }
+
+    images.pin(ids);
+}
+
+void saori::leave()
+{
+    images.unpin();
+}
+
 bool saori::unload()
 {
+    // [J[~
+    workers.reset();
+    worker_scratches.clear();
+
+    // k̉摜͔fɎ̂Ă
+    // v[jƃL[̎cŝŁAɎĂ
+    compress_cancelled = true;
+    compressor.reset();
+    compressed_jobs.clear();
+    compress_cancelled = false;
+
+    // SẲ摜jāAv[Ɏcobt@
+    images.clear();
+    loaded_images.clear();
+    buffer_pool::instance().trim();
+
     return true;
 }
\ No newline at end of file
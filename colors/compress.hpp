@@ -0,0 +1,221 @@
+/*
+    compress.hpp
+    COLORS Image Compression Library
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstring>
+
+#include "image.hpp"
+
+// ̍sƂ̍OXňk摜
+// ȗ̈PF̗̈悪fނقǏȂAWJ 1 ̑ōς
+class compressed_image
+{
+public:
+    compressed_image()
+        : _width(0), _height(0), _premultiplied(false)
+    {
+    }
+    inline int width() const
+    {
+        return _width;
+    }
+    inline int height() const
+    {
+        return _height;
+    }
+    // kf[^̃TCY
+    inline size_t bytes() const
+    {
+        return _data.capacity();
+    }
+    // WJɎg
+    inline size_t raw_bytes() const
+    {
+        return static_cast<size_t>(image::pitch(_width)) * _height * sizeof(color);
+    }
+    // \ɏȂȂꍇ false Ԃ
+    bool compress(const image &src)
+    {
+        _width = src.width();
+        _height = src.height();
+        _premultiplied = src.premultiplied();
+        _data.clear();
+
+        if (_width <= 0 || _height <= 0)
+        {
+            return false;
+        }
+
+        // ̃TCY 3/4 𒴂_Œ߂
+        size_t limit = raw_bytes() / 4 * 3;
+
+        size_t length = static_cast<size_t>(_width) * sizeof(color);
+
+        std::vector<unsigned char> delta(length);
+
+        for (int y = 0; y < _height; ++y)
+        {
+            const unsigned char *current = reinterpret_cast<const unsigned char *>(src.row(y));
+
+            if (y == 0)
+            {
+                memcpy(&delta[0], current, length);
+            }
+            else
+            {
+                const unsigned char *above = reinterpret_cast<const unsigned char *>(src.row(y - 1));
+
+                for (size_t i = 0; i < length; ++i)
+                {
+                    delta[i] = static_cast<unsigned char>(current[i] - above[i]);
+                }
+            }
+
+            encode_row(&delta[0], length);
+
+            if (_data.size() > limit)
+            {
+                _data.clear();
+                _data.shrink_to_fit();
+                return false;
+            }
+        }
+
+        _data.shrink_to_fit();
+
+        return true;
+    }
+    bool decompress(image &dst) const
+    {
+        if (!dst.resize(_width, _height, false))
+        {
+            return false;
+        }
+
+        dst.premultiplied(_premultiplied);
+
+        size_t length = static_cast<size_t>(_width) * sizeof(color);
+
+        const unsigned char *p = _data.data();
+        const unsigned char *end = p + _data.size();
+
+        for (int y = 0; y < _height; ++y)
+        {
+            unsigned char *current = reinterpret_cast<unsigned char *>(dst.row(y));
+
+            p = decode_row(p, end, current, length);
+
+            if (p == NULL)
+            {
+                return false;
+            }
+
+            // ɏ̍s𑫂Čɖ߂
+            if (y > 0)
+            {
+                const unsigned char *above = reinterpret_cast<const unsigned char *>(dst.row(y - 1));
+
+                for (size_t i = 0; i < length; ++i)
+                {
+                    current[i] = static_cast<unsigned char>(current[i] + above[i]);
+                }
+            }
+        }
+        return true;
+    }
+private:
+    // oCg 128 Ȃ瑱 (n + 1) oCĝ܂܁A128 ȏȂ玟 1 oCg (n - 125) JԂ
+    static const size_t max_literal = 128;
+    static const size_t min_run = 3;
+    static const size_t max_run = 130;
+
+    void encode_row(const unsigned char *p, size_t length)
+    {
+        size_t i = 0;
+
+        while (i < length)
+        {
+            // l߂
+            size_t run = 1;
+
+            while (i + run < length && run < max_run && p[i + run] == p[i])
+            {
+                run += 1;
+            }
+
+            if (run >= min_run)
+            {
+                _data.push_back(static_cast<unsigned char>(run - min_run + 128));
+                _data.push_back(p[i]);
+                i += run;
+                continue;
+            }
+
+            // ɌJԂn܂܂ł܂Ƃ߂ďo
+            size_t start = i;
+
+            while (i < length && i - start < max_literal)
+            {
+                if (i + 2 < length && p[i] == p[i + 1] && p[i] == p[i + 2])
+                {
+                    break;
+                }
+                i += 1;
+            }
+
+            _data.push_back(static_cast<unsigned char>(i - start - 1));
+            _data.insert(_data.end(), p + start, p + i);
+        }
+    }
+    // 1 sWJāA̍s̈ʒuԂAf[^Ăꍇ NULL Ԃ
+    static const unsigned char *decode_row(const unsigned char *p, const unsigned char *end, unsigned char *dst, size_t length)
+    {
+        size_t i = 0;
+
+        while (i < length)
+        {
+            if (p >= end)
+            {
+                return NULL;
+            }
+
+            size_t control = *p++;
+
+            if (control >= 128)
+            {
+                size_t run = control - 128 + min_run;
+
+                if (p >= end || i + run > length)
+                {
+                    return NULL;
+                }
+
+                memset(dst + i, *p++, run);
+                i += run;
+            }
+            else
+            {
+                size_t count = control + 1;
+
+                if (p + count > end || i + count > length)
+                {
+                    return NULL;
+                }
+
+                memcpy(dst + i, p, count);
+                p += count;
+                i += count;
+            }
+        }
+        return p;
+    }
+private:
+    int _width;
+    int _height;
+    bool _premultiplied;
+    std::vector<unsigned char> _data;
+};
\ No newline at end of file
@@ -6,15 +6,158 @@
 #pragma once
 
 #include "image.hpp"
+#include "mask.hpp"
+#include "palette.hpp"
 
-bool draw_image(image &base, const image &elem, int x, int y, int opacity)
+// `挳̍s̈ʒu擾
+inline const color *source_row(const image &src, int x, int y)
+{
+    return src.row(y) + x;
+}
+
+// pbg摜̍śAYŎQƂ_Ńpbg̐FԂ
+inline palette_row source_row(const indexed_image &src, int x, int y)
+{
+    return palette_row(src.row(y) + x, src.palette());
+}
+
+// Zς݃At@m 1 sAZsvŐϘaōς
+template<class Row>
+inline void draw_premultiplied_row(color *p_base, const Row &p_elem, int width, int opacity)
+{
+    const alpha_table &table = alpha_table::instance();
+
+    // sx 0 - 255 ̌Wɂ
+    const unsigned char *scale = table.multiply[round_pixel(opacity * 255 / 100)];
+
+    for (int j = 0; j < width; ++j)
+    {
+        int beta = scale[p_elem[j].alpha()];
+
+        if (beta == 0)
+        {
+            continue;
+        }
+
+        // `͕`挳̕sx̕߂
+        const unsigned char *rest = table.multiply[255 - beta];
+
+        p_base[j] = color(beta + rest[p_base[j].alpha()],
+            scale[p_elem[j].red()] + rest[p_base[j].red()],
+            scale[p_elem[j].green()] + rest[p_base[j].green()],
+            scale[p_elem[j].blue()] + rest[p_base[j].blue()]);
+    }
+}
+
+// Xg[gAt@m 1 s
+template<class Row>
+inline void draw_straight_row(color *p_base, const Row &p_elem, int width, int opacity)
+{
+    for (int j = 0; j < width; ++j)
+    {
+        int alpha = p_base[j].alpha();
+        int beta = p_elem[j].alpha() * opacity / 100;
+
+        alpha = (255 - beta) * alpha / 255;
+
+        int total = alpha + beta;
+
+        if (total == 0)
+        {
+            continue;
+        }
+
+        p_base[j].red((p_base[j].red() * alpha + p_elem[j].red() * beta) / total);
+        p_base[j].green((p_base[j].green() * alpha + p_elem[j].green() * beta) / total);
+        p_base[j].blue((p_base[j].blue() * alpha + p_elem[j].blue() * beta) / total);
+        p_base[j].alpha(total);
+    }
+}
+
+// `𑵂`挳`悷A`挳 source_row ōs擾łΗǂ
+template<class Source>
+bool draw_pixels(image &base, const Source &elem, int x, int y, int opacity)
 {
     // TCY擾
     int width = elem.width();
     int height = elem.height();
 
-    int stripe = width;
-    int src_width = base.width();
+    // NbsO
+    int sx = 0, sy = 0;
+    if (!base.calc_clipping(x, y, sx, sy, width, height))
+    {
+        return false;
+    }
+
+    for (int i = y; i < height + y; ++i)
+    {
+        // `挳̓r[̏ꍇ̂ōsPʂňʒu߂
+        auto p_elem = source_row(elem, sx, sy + i - y);
+        color *p_base = base.row(i) + x;
+
+        if (base.premultiplied())
+        {
+            draw_premultiplied_row(p_base, p_elem, width, opacity);
+        }
+        else
+        {
+            draw_straight_row(p_base, p_elem, width, opacity);
+        }
+    }
+    return true;
+}
+
+bool draw_image(image &base, const image &elem, int x, int y, int opacity)
+{
+    // `قȂꍇ͕`挳`̌`ɍ킹
+    if (elem.premultiplied() != base.premultiplied())
+    {
+        image converted(elem);
+
+        if (base.premultiplied())
+        {
+            converted.premultiply();
+        }
+        else
+        {
+            converted.unpremultiply();
+        }
+
+        return draw_image(base, converted, x, y, opacity);
+    }
+
+    return draw_pixels(base, elem, x, y, opacity);
+}
+
+// pbg摜`悷AF̓pbg璼ړǂݍ
+bool draw_indexed(image &base, const indexed_image &elem, int x, int y, int opacity)
+{
+    // `قȂꍇ̓pbgϊ
+    if (elem.premultiplied() != base.premultiplied())
+    {
+        indexed_image converted(elem);
+
+        if (base.premultiplied())
+        {
+            converted.premultiply();
+        }
+        else
+        {
+            converted.unpremultiply();
+        }
+
+        return draw_pixels(base, converted, x, y, opacity);
+    }
+
+    return draw_pixels(base, elem, x, y, opacity);
+}
+
+// }XN`挳ɂāAAt@lɉĎw肵Fŕ`悷
+bool draw_mask(image &base, const alpha_mask &mask, const color &fill_color, int x, int y, int opacity)
+{
+    // TCY擾
+    int width = mask.width();
+    int height = mask.height();
 
     // NbsO
     int sx = 0, sy = 0;
@@ -23,45 +166,116 @@ bool draw_image(image &base, const image &elem, int x, int y, int opacity)
         return false;
     }
 
-    const color *p_elem = &elem[stripe * sy + sx];
+    const alpha_table &table = alpha_table::instance();
 
-    for (int i = y; i < height + y; ++i)
+    if (base.premultiplied())
     {
-        color *p_base = &base[src_width * i + x];
+        // FxZς݂ɂāA}XNƕsx܂Ƃ߂WŎ߂
+        color value = premultiply_color(fill_color, table);
 
-        for (int j = 0; j < width; ++j)
+        const unsigned char *scale = table.multiply[round_pixel(opacity * 255 / 100)];
+
+        for (int i = y; i < height + y; ++i)
         {
-            int alpha = p_base[j].alpha();
-            int beta = p_elem[j].alpha() * opacity / 100;
+            const unsigned char *p_mask = mask.row(sy + i - y) + sx;
+            color *p_base = base.row(i) + x;
 
-            alpha = (255 - beta) * alpha / 255;
+            for (int j = 0; j < width; ++j)
+            {
+                const unsigned char *coverage = table.multiply[scale[p_mask[j]]];
 
-            int total = alpha + beta;
+                int beta = coverage[value.alpha()];
+
+                if (beta == 0)
+                {
+                    continue;
+                }
+
+                const unsigned char *rest = table.multiply[255 - beta];
+
+                p_base[j] = color(beta + rest[p_base[j].alpha()],
+                    coverage[value.red()] + rest[p_base[j].red()],
+                    coverage[value.green()] + rest[p_base[j].green()],
+                    coverage[value.blue()] + rest[p_base[j].blue()]);
+            }
+        }
+        return true;
+    }
+
+    // F̃At@lƕsx܂Ƃ߂Ă
+    const unsigned char *scale = table.multiply[round_pixel(fill_color.alpha() * opacity / 100)];
 
-            if (total == 0)
+    for (int i = y; i < height + y; ++i)
+    {
+        const unsigned char *p_mask = mask.row(sy + i - y) + sx;
+        color *p_base = base.row(i) + x;
+
+        for (int j = 0; j < width; ++j)
+        {
+            int beta = scale[p_mask[j]];
+
+            if (beta == 0)
             {
                 continue;
             }
 
-            p_base[j].red((p_base[j].red() * alpha + p_elem[j].red() * beta) / total);
-            p_base[j].green((p_base[j].green() * alpha + p_elem[j].green() * beta) / total);
-            p_base[j].blue((p_base[j].blue() * alpha + p_elem[j].blue() * beta) / total);
+            int alpha = (255 - beta) * p_base[j].alpha() / 255;
+
+            int total = alpha + beta;
+
+            p_base[j].red((p_base[j].red() * alpha + fill_color.red() * beta) / total);
+            p_base[j].green((p_base[j].green() * alpha + fill_color.green() * beta) / total);
+            p_base[j].blue((p_base[j].blue() * alpha + fill_color.blue() * beta) / total);
             p_base[j].alpha(total);
         }
-
-        p_elem += stripe;
     }
     return true;
 }
 
-void fill_image(image &img, color &fill_color)
+// }XNŉ摜؂蔲A}XN͈̔͊O͓ɂȂ
+void clip_image(image &img, const alpha_mask &mask, int x, int y)
 {
-    int length = img.width() * img.height();
+    const alpha_table &table = alpha_table::instance();
 
-    color *pixels = img.buffer();
+    int width = img.width();
+    int height = img.height();
 
-    for (int i = 0; i < length; ++i)
+    for (int i = 0; i < height; ++i)
     {
-        pixels[i] = fill_color;
+        color *pixels = img.row(i);
+
+        for (int j = 0; j < width; ++j)
+        {
+            const unsigned char *coverage = table.multiply[mask.alpha(j - x, i - y)];
+
+            // Zς݃At@̏ꍇ͐FŎ߂
+            if (img.premultiplied())
+            {
+                pixels[j] = color(coverage[pixels[j].alpha()], coverage[pixels[j].red()], coverage[pixels[j].green()], coverage[pixels[j].blue()]);
+            }
+            else
+            {
+                pixels[j].alpha(coverage[pixels[j].alpha()]);
+            }
+        }
+    }
+}
+
+void fill_image(image &img, const color &fill_color)
+{
+    int width = img.width();
+    int height = img.height();
+
+    // Zς݃At@̉摜ɂ͕ϊFœh
+    color value = img.premultiplied() ? premultiply_color(fill_color) : fill_color;
+
+    for (int y = 0; y < height; ++y)
+    {
+        color *pixels = img.row(y);
+
+        for (int x = 0; x < width; ++x)
+        {
+            pixels[x] = value;
+        }
     }
 }
\ No newline at end of file
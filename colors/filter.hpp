@@ -0,0 +1,245 @@
+/*
+    filter.hpp
+    COLORS Image Filter Library
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "image.hpp"
+#include "stream.hpp"
+
+// 1 s{bNXtB^łڂÄO͒[̃sNZg
+inline void box_blur_row(const unsigned char *src, unsigned char *dst, int length, int radius)
+{
+    unsigned int size = radius * 2 + 1;
+    unsigned int sum = src[0] * (radius + 1);
+
+    for (int i = 1; i <= radius; ++i)
+    {
+        sum += src[std::min(i, length - 1)];
+    }
+
+    for (int x = 0; x < length; ++x)
+    {
+        dst[x] = static_cast<unsigned char>((sum + size / 2) / size);
+
+        //  1 sNZi߂
+        sum += src[std::min(x + radius + 1, length - 1)];
+        sum -= src[std::max(x - radius, 0)];
+    }
+}
+
+// Ƀ{bNXtB^łڂ
+// sPʂōvXV̂ŁÃ[v͓`l̘Al
+inline void box_blur_columns(const planar_image &src, planar_image &dst, int channel, int radius, std::vector<unsigned int> &sums)
+{
+    int width = src.width();
+    int height = src.height();
+    unsigned int size = radius * 2 + 1;
+
+    sums.assign(width, 0);
+
+    unsigned int *sum = &sums[0];
+
+    // 擪̍s͏[̃sNZŖ߂
+    const unsigned char *first = src.row(channel, 0);
+
+    for (int x = 0; x < width; ++x)
+    {
+        sum[x] = first[x] * (radius + 1);
+    }
+
+    for (int i = 1; i <= radius; ++i)
+    {
+        const unsigned char *p = src.row(channel, std::min(i, height - 1));
+
+        for (int x = 0; x < width; ++x)
+        {
+            sum[x] += p[x];
+        }
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        unsigned char *out = dst.row(channel, y);
+
+        for (int x = 0; x < width; ++x)
+        {
+            out[x] = static_cast<unsigned char>((sum[x] + size / 2) / size);
+        }
+
+        //  1 si߂
+        const unsigned char *in = src.row(channel, std::min(y + radius + 1, height - 1));
+        const unsigned char *out_row = src.row(channel, std::max(y - radius, 0));
+
+        for (int x = 0; x < width; ++x)
+        {
+            sum[x] += in[x];
+            sum[x] -= out_row[x];
+        }
+    }
+}
+
+// \ȃtB^ŃTvO
+// `lɕsNZgA͓`l̘Al܂Ƃ߂ď
+// ɃTvOśAɕKvȕOobt@ɕێ
+void resample_planar(const image &src, image &dst, const resample_filter &filter)
+{
+    int width = dst.width();
+    int height = dst.height();
+
+    weight_table horizontal;
+    weight_table vertical;
+
+    horizontal.build_sampled(src.width(), width, filter);
+    vertical.build_sampled(src.height(), height, filter);
+
+    int ring_size = 1;
+    for (int y = 0; y < height; ++y)
+    {
+        ring_size = std::max(ring_size, vertical.last(y) - vertical.first(y) + 1);
+    }
+
+    const planar_image &planes = src.planar();
+
+    planar_image work(width, height);
+
+    std::vector<float> ring(static_cast<size_t>(ring_size) * width);
+    std::vector<float> accum(width);
+
+    for (int c = 0; c < 4; ++c)
+    {
+        // ɐɃTvO錳̍s
+        int next_row = 0;
+
+        for (int y = 0; y < height; ++y)
+        {
+            while (next_row <= vertical.last(y))
+            {
+                const unsigned char *p = planes.row(c, next_row);
+                float *q = &ring[static_cast<size_t>(next_row % ring_size) * width];
+
+                for (int x = 0; x < width; ++x)
+                {
+                    float sum = 0.0f;
+
+                    for (int k = horizontal.offsets[x]; k < horizontal.offsets[x + 1]; ++k)
+                    {
+                        sum += p[horizontal.indices[k]] * horizontal.weights[k];
+                    }
+
+                    q[x] = sum;
+                }
+
+                next_row += 1;
+            }
+
+            // ɏdݕts
+            std::fill(accum.begin(), accum.end(), 0.0f);
+
+            float *sum = &accum[0];
+
+            for (int k = vertical.offsets[y]; k < vertical.offsets[y + 1]; ++k)
+            {
+                const float *r = &ring[static_cast<size_t>(vertical.indices[k] % ring_size) * width];
+                float weight = vertical.weights[k];
+
+                for (int x = 0; x < width; ++x)
+                {
+                    sum[x] += r[x] * weight;
+                }
+            }
+
+            unsigned char *out = work.row(c, y);
+
+            for (int x = 0; x < width; ++x)
+            {
+                out[x] = static_cast<unsigned char>(round_pixel(static_cast<int>(sum[x] + 0.5f)));
+            }
+        }
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        work.gather_row(dst.row(y), y);
+    }
+}
+
+// {bNXtB^ 3 񂩂ăKEXڂɋߎ
+// `lɕsNZgẢ摜̕ϊʂ̓LbV
+void blur_image(const image &src, image &dst, int radius)
+{
+    static const int passes = 3;
+
+    int width = src.width();
+    int height = src.height();
+
+    const planar_image &planes = src.planar();
+
+    planar_image work(width, height);
+    planar_image temp(width, height);
+
+    // Xg[gAt@̏ꍇ́AȃsNZ̐F܂Ȃ悤ɏZς݂ɂĂڂ
+    const alpha_table &table = alpha_table::instance();
+
+    for (int y = 0; y < height; ++y)
+    {
+        const unsigned char *a = planes.row(planar_image::alpha, y);
+
+        memcpy(work.row(planar_image::alpha, y), a, width);
+
+        for (int c = planar_image::red; c <= planar_image::blue; ++c)
+        {
+            const unsigned char *p = planes.row(c, y);
+            unsigned char *q = work.row(c, y);
+
+            if (src.premultiplied())
+            {
+                memcpy(q, p, width);
+                continue;
+            }
+
+            for (int x = 0; x < width; ++x)
+            {
+                q[x] = table.multiply[a[x]][p[x]];
+            }
+        }
+    }
+
+    std::vector<unsigned int> sums;
+
+    for (int c = 0; c < 4; ++c)
+    {
+        for (int i = 0; i < passes; ++i)
+        {
+            for (int y = 0; y < height; ++y)
+            {
+                box_blur_row(work.row(c, y), temp.row(c, y), width, radius);
+            }
+
+            box_blur_columns(temp, work, c, radius, sums);
+        }
+    }
+
+    // ̌`ɖ߂Ȃ珑o
+    dst.resize(width, height, false);
+    dst.premultiplied(src.premultiplied());
+
+    for (int y = 0; y < height; ++y)
+    {
+        color *row = dst.row(y);
+
+        work.gather_row(row, y);
+
+        if (!src.premultiplied())
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                row[x] = unpremultiply_color(row[x], table);
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -6,6 +6,18 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
+#include <type_traits>
+#include <cstdint>
+#include <climits>
+#include <cstring>
+
+#if defined(_MSC_VER) || defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "allocator.hpp"
+#include "mapped_file.hpp"
 
 template<int min, int max>
 inline int round_pixel(int val)
@@ -27,8 +39,8 @@ inline T reverse_endian(T val)
 struct color
 {
 public:
-    // f[^^J
-    typedef unsigned long value_type;
+    // f[^^JALP64 ł 32bit ɂȂ悤ɌŒ肷
+    typedef uint32_t value_type;
     typedef unsigned char pixel_type;
     // f[^
     union
@@ -57,10 +69,7 @@ public:
         : _abgr(reverse_endian(rgb << 8) + (round_pixel(a) << 24))
     {
     }
-    color(const color &obj)
-        : _abgr(obj.to_abgr())
-    {
-    }
+    color(const color &obj) = default;
     color(int a, const color &obj)
         : _abgr((obj.to_abgr() & 0xFFFFFF) + (round_pixel(a) << 24))
     {
@@ -133,11 +142,7 @@ public:
     {
         return (_pixel[3] << 24) + (_pixel[0] << 16) + (_pixel[1] << 8) + _pixel[2];
     }
-    inline color &operator=(const color &obj)
-    {
-        _abgr = obj.to_abgr();
-        return *this;
-    }
+    color &operator=(const color &obj) = default;
     inline bool equals_without_alpha(const color &obj) const
     {
         return (_abgr & 0xFFFFFF) == (obj.to_abgr() & 0xFFFFFF);
@@ -148,15 +153,153 @@ public:
     }
 };
 
+// libpng  RGBA ̍sƂ̂܂ܑΉ邽߁A1 sNZ͕K 4 oCgɂ
+static_assert(sizeof(color) == 4, "color must be 4 bytes");
+// sPʂ memcpy ł悤ɂ
+static_assert(std::is_trivially_copyable<color>::value, "color must be trivially copyable");
+
+// Zς݃At@Ƃ̕ϊɎge[u
+// ĂlςȂ悤ɁAǂľܓmȒl
+struct alpha_table
+{
+    alpha_table()
+    {
+        for (int a = 0; a < 256; ++a)
+        {
+            for (int c = 0; c < 256; ++c)
+            {
+                multiply[a][c] = static_cast<unsigned char>((c * a + 127) / 255);
+                divide[a][c] = static_cast<unsigned char>(a == 0 ? 0 : round_pixel((c * 255 + a / 2) / a));
+            }
+        }
+    }
+    static const alpha_table &instance()
+    {
+        static const alpha_table table;
+        return table;
+    }
+    // c * a / 255
+    unsigned char multiply[256][256];
+    // c * 255 / aAa  0 ̏ꍇ 0
+    unsigned char divide[256][256];
+};
+
+inline color premultiply_color(const color &c, const alpha_table &table = alpha_table::instance())
+{
+    const unsigned char *m = table.multiply[c.alpha()];
+    return color(c.alpha(), m[c.red()], m[c.green()], m[c.blue()]);
+}
+
+inline color unpremultiply_color(const color &c, const alpha_table &table = alpha_table::instance())
+{
+    const unsigned char *d = table.divide[c.alpha()];
+    return color(c.alpha(), d[c.red()], d[c.green()], d[c.blue()]);
+}
+
+// `lɕĕێsNZ (SoA)
+// `l̒lÂŁA`lPʂ̏̂܂܃xNgł
+class planar_image
+{
+public:
+    // `l̔ԍAcolor ̃̕тƓ
+    enum channel
+    {
+        red = 0,
+        green = 1,
+        blue = 2,
+        alpha = 3,
+    };
+    planar_image(int width, int height)
+        : _width(width), _height(height), _stride((width + row_alignment - 1) / row_alignment * row_alignment)
+    {
+        _block = buffer_pool::instance().allocate(static_cast<size_t>(_stride) * height * 4);
+    }
+    ~planar_image()
+    {
+        buffer_pool::instance().release(_block);
+    }
+    inline int width() const
+    {
+        return _width;
+    }
+    inline int height() const
+    {
+        return _height;
+    }
+    // s̐擪玟̍s̐擪܂ł̃oCg
+    inline int stride() const
+    {
+        return _stride;
+    }
+    inline unsigned char *row(int channel, int y)
+    {
+        return static_cast<unsigned char *>(_block.data) + (static_cast<size_t>(channel) * _height + y) * _stride;
+    }
+    inline const unsigned char *row(int channel, int y) const
+    {
+        return static_cast<const unsigned char *>(_block.data) + (static_cast<size_t>(channel) * _height + y) * _stride;
+    }
+    // color  1 se`lɕ
+    void scatter_row(const color *src, int y)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(src);
+        unsigned char *r = row(red, y);
+        unsigned char *g = row(green, y);
+        unsigned char *b = row(blue, y);
+        unsigned char *a = row(alpha, y);
+        for (int x = 0; x < _width; ++x)
+        {
+            r[x] = p[x * 4 + 0];
+            g[x] = p[x * 4 + 1];
+            b[x] = p[x * 4 + 2];
+            a[x] = p[x * 4 + 3];
+        }
+    }
+    // e`l color  1 sɂ܂Ƃ߂
+    void gather_row(color *dst, int y) const
+    {
+        unsigned char *p = reinterpret_cast<unsigned char *>(dst);
+        const unsigned char *r = row(red, y);
+        const unsigned char *g = row(green, y);
+        const unsigned char *b = row(blue, y);
+        const unsigned char *a = row(alpha, y);
+        for (int x = 0; x < _width; ++x)
+        {
+            p[x * 4 + 0] = r[x];
+            p[x * 4 + 1] = g[x];
+            p[x * 4 + 2] = b[x];
+            p[x * 4 + 3] = a[x];
+        }
+    }
+private:
+    planar_image(const planar_image &);
+    planar_image &operator=(const planar_image &);
+private:
+    int _width;
+    int _height;
+    int _stride;
+    buffer_block _block;
+};
+
+class image;
+
+template<class Source, class Sampler>
+void sample_image(const Source &src, image &dst, Sampler s);
+
 class image
 {
 public:
     image()
-        : _width(0), _height(0)
+        : _width(0), _height(0), _stride(0), _offset(0), _premultiplied(false), _mapped(false)
     {
     }
     image(int width, int height)
-        : _width(width), _height(height), _buffer(new color[width * height])
+        : _width(width), _height(height), _stride(pitch(width)), _offset(0), _premultiplied(false), _mapped(false), _buffer(allocate(width, height))
+    {
+    }
+    // ̃obt@Lč쐬
+    image(int width, int height, const std::shared_ptr<color> &buffer)
+        : _width(width), _height(height), _stride(pitch(width)), _offset(0), _premultiplied(false), _mapped(false), _buffer(buffer)
     {
     }
     inline int width() const
@@ -167,141 +310,306 @@ public:
     {
         return _height;
     }
+    // s̐擪玟̍s̐擪܂ł̃sNZ
+    inline int stride() const
+    {
+        return _stride;
+    }
+    // sNZZς݃At@ŕێĂ
+    inline bool premultiplied() const
+    {
+        return _premultiplied;
+    }
+    // `ݒ肷邾ŕῗȂA쐬̃obt@Ɏg
+    inline void premultiplied(bool value)
+    {
+        _premultiplied = value;
+    }
+    // Xg[gAt@Zς݃At@ɕϊ
+    void premultiply()
+    {
+        if (!_premultiplied)
+        {
+            const alpha_table &table = alpha_table::instance();
+            transform([&table](color &pixel) { pixel = premultiply_color(pixel, table); });
+            _premultiplied = true;
+        }
+    }
+    // Zς݃At@Xg[gAt@ɖ߂
+    void unpremultiply()
+    {
+        if (_premultiplied)
+        {
+            const alpha_table &table = alpha_table::instance();
+            transform([&table](color &pixel) { pixel = unpremultiply_color(pixel, table); });
+            _premultiplied = false;
+        }
+    }
+    // obt@ꎞt@CɃ}bvĂ
+    inline bool mapped() const
+    {
+        return _mapped;
+    }
+    // }bvt@C쐬fBNgȀꍇ͈ꎞfBNgg
+    // 񓯊̌Ăяoǂ܂̂ŁAbN擾ĕԂ
+    static string_t scratch_directory()
+    {
+        std::lock_guard<std::mutex> lock(scratch_mutex());
+        return scratch_path();
+    }
+    static void scratch_directory(const string_t &directory)
+    {
+        std::lock_guard<std::mutex> lock(scratch_mutex());
+        scratch_path() = directory;
+    }
+    // s̃sNZ߂Aes̐擪 row_alignment ɑ悤ɐ؂グ
+    static inline int pitch(int width)
+    {
+        static const int pixels = row_alignment / sizeof(color);
+        return (width + pixels - 1) / pixels * pixels;
+    }
+    // 쐬ł傫AsNZ int ɁAoCg size_t Ɏ܂Kv
+    static inline bool valid_size(int width, int height)
+    {
+        static const int pixels = row_alignment / sizeof(color);
+        if (width <= 0 || height <= 0 || width > INT_MAX - pixels)
+        {
+            return false;
+        }
+        return pitch(width) <= INT_MAX / height && static_cast<size_t>(pitch(width)) * height <= SIZE_MAX / sizeof(color);
+    }
+    // ݗp̃ANZX́Aobt@LĂΐɕ
+    // YɂANZX y * stride() + x ňʒu߂邱
     inline color *buffer()
     {
+        detach();
         return _buffer.get();
     }
     inline const color *buffer() const
     {
-        return _buffer.get();
+        return _buffer.get() + _offset;
+    }
+    inline color &operator[](size_t index)
+    {
+        detach();
+        return _buffer.get()[index];
     }
-    inline color &operator[](int index)
+    inline const color &operator[](size_t index) const
     {
-        return _buffer[index];
+        return _buffer.get()[_offset + index];
     }
-    inline const color &operator[](int index) const
+    inline color *row(int y)
     {
-        return _buffer[index];
+        detach();
+        return _buffer.get() + static_cast<size_t>(_stride) * y;
+    }
+    inline const color *row(int y) const
+    {
+        return _buffer.get() + _offset + static_cast<size_t>(_stride) * y;
     }
     inline void pixel(const color &value, int x, int y)
     {
         if (x >= 0 && x < _width && y >= 0 && y < _height)
         {
-            _buffer[_width * y + x] = value;
+            row(y)[x] = value;
         }
     }
     inline const color &pixel(int x, int y) const
     {
         if (x >= 0 && x < _width && y >= 0 && y < _height)
         {
-            return _buffer[_width * y + x];
+            return row(y)[x];
         }
-        return _buffer[0];
+        return row(0)[0];
     }
     inline void pixel_no_check(const color &value, int x, int y)
     {
-        _buffer[_width * y + x] = value;
+        row(y)[x] = value;
     }
     inline const color &pixel_no_check(int x, int y) const
     {
-        return _buffer[_width * y + x];
+        return row(y)[x];
+    }
+    // `lɕsNZ擾
+    // ɕϊăLbVA摜ɏ܂܂Ŏg
+    // const ȓǂݍ݂͕̃Xbh瓯ɌĂ΂Ăǂ悤ɁALbV͕sɓǂݏ
+    const planar_image &planar() const
+    {
+        std::shared_ptr<const planar_image> cached = std::atomic_load(&_planar);
+        if (!cached)
+        {
+            std::shared_ptr<planar_image> planes = std::make_shared<planar_image>(_width, _height);
+            for (int y = 0; y < _height; ++y)
+            {
+                planes->scatter_row(row(y), y);
+            }
+            // ̃Xbhɍ쐬Ă΁Ag
+            cached = std::move(planes);
+            std::shared_ptr<const planar_image> expected;
+            if (!std::atomic_compare_exchange_strong(&_planar, &expected, cached))
+            {
+                cached = std::move(expected);
+            }
+        }
+        return *cached;
+    }
+    // `l̃LbVgpĂ郁ʁA쐬ĂȂ 0
+    size_t planar_bytes() const
+    {
+        std::shared_ptr<const planar_image> cached = std::atomic_load(&_planar);
+        return cached ? static_cast<size_t>(cached->stride()) * cached->height() * 4 : 0;
+    }
+    // ̉摜ƋLĂobt@
+    inline const std::shared_ptr<color> &shared_buffer() const
+    {
+        return _buffer;
+    }
+    inline bool shared() const
+    {
+        return _buffer.use_count() > 1;
+    }
+    // ̉摜̃obt@̈ꕔQƂĂ
+    inline bool is_view() const
+    {
+        return _offset != 0 || _stride != pitch(_width);
+    }
+    // obt@LĂA̓r[̏ꍇ͕āẢ摜pɂ
+    void detach()
+    {
+        // ܂̂Ń`l̃LbV͖ɂȂ
+        if (_planar)
+        {
+            _planar.reset();
+        }
+        if (shared() || is_view())
+        {
+            int stride = pitch(_width);
+            std::shared_ptr<color> buffer = _mapped ? allocate_mapped(_width, _height) : allocate(_width, _height, false);
+            if (!buffer)
+            {
+                throw std::bad_alloc();
+            }
+            for (int y = 0; y < _height; ++y)
+            {
+                memcpy(buffer.get() + static_cast<size_t>(stride) * y, _buffer.get() + _offset + static_cast<size_t>(_stride) * y, _width * sizeof(color));
+            }
+            _buffer = std::move(buffer);
+            _stride = stride;
+            _offset = 0;
+        }
     }
     bool sub_image(image &dst, int x, int y, int width, int height) const
     {
         int sx = 0, sy = 0;
-        int original_width = width;
-        if (!calc_clipping(x, y, sx, sy, width, height))
+        if (!calc_clipping(x, y, sx, sy, width, height) || !dst.resize(width, height, false))
         {
             return false;
         }
-        int src_width = _width;
-        int stride = width * sizeof(color);
-        dst.resize(width, height);
-        color *p = &dst[original_width * sy + sx];
-        for (int i = y; i < height + y; ++i)
+        for (int i = 0; i < height; ++i)
+        {
+            memcpy(dst.row(i), row(y + i) + x, width * sizeof(color));
+        }
+        dst._premultiplied = _premultiplied;
+        return true;
+    }
+    // Rs[ɁAobt@L܂܈ꕔQƂ摜쐬
+    bool view(image &dst, int x, int y, int width, int height) const
+    {
+        int sx = 0, sy = 0;
+        if (!calc_clipping(x, y, sx, sy, width, height) || width <= 0 || height <= 0)
         {
-            memcpy(p, &_buffer[src_width * i + x], stride);
-            p += original_width;
+            return false;
         }
+        dst._width = width;
+        dst._height = height;
+        dst._stride = _stride;
+        dst._offset = _offset + static_cast<size_t>(_stride) * y + x;
+        dst._premultiplied = _premultiplied;
+        // ܂ꂽ_Ńq[vɕ
+        dst._mapped = false;
+        dst._buffer = _buffer;
+        dst._planar.reset();
         return true;
     }
-    bool resize(int width, int height)
+    // SẴsNZޏꍇ clear  false ɂďȗł
+    bool resize(int width, int height, bool clear = true)
     {
-        if (width <= 0 || height <= 0)
+        if (!valid_size(width, height))
         {
             return false;
         }
         _width = width;
         _height = height;
-        _buffer.reset(new color[width * height]);
+        _stride = pitch(width);
+        _offset = 0;
+        _mapped = false;
+        _buffer = allocate(width, height, clear);
+        _planar.reset();
         return true;
     }
-    template<class Sampler>
-    void resize(image &dst, Sampler s) const
+    // obt@ꎞt@CɃ}bvč쐬ASẴsNZ͓ɂȂ
+    // y[W͕KvɂȂ_œǂݏ̂ŁAɎ܂Ȃ傫ł
+    bool map(int width, int height)
     {
-        // TCY摜̃TCY擾
-        int width = dst.width();
-        int height = dst.height();
-
-        // sNZ̍őlvZ
-        int px_width = _width - 1;
-        int px_height = _height - 1;
-
-        // XP[vZ
-        double scale_x = static_cast<double>(width) / _width;
-        double scale_y = static_cast<double>(height) / _height;
-
-        // ̂߂ɈꎞIɃ|C^g
-        color *pixels = dst.buffer();
-
-        // ۂ̏
-        for (int y = 0; y < height; ++y)
+        if (!valid_size(width, height))
         {
-            // ̂ߎOɌvZ
-            double calc_y = (y / scale_y);
-
-            // X Ƀ[v
-            for (int x = 0; x < width; ++x)
-            {
-                // IWił̈ʒuvZāAsampler ɏC
-                s(*this, (x / scale_x), calc_y, px_width, px_height, pixels[x]);
-            }
-
-            // |C^ړ
-            pixels += width;
+            return false;
+        }
+        std::shared_ptr<color> buffer = allocate_mapped(width, height);
+        if (!buffer)
+        {
+            return false;
         }
+        _width = width;
+        _height = height;
+        _stride = pitch(width);
+        _offset = 0;
+        _mapped = true;
+        _buffer = std::move(buffer);
+        _planar.reset();
+        return true;
+    }
+    template<class Sampler>
+    void resize(image &dst, Sampler s) const
+    {
+        sample_image(*this, dst, s);
     }
     template<class Function>
     void transform(Function f)
     {
         // ̂߈ꎞIɃ|C^g
-        color *pixels = buffer();
-
-        // OăsNZvZĂ
-        int length = _width * _height;
+        color *line = buffer();
 
         // [vA[
-        int mod = length & 7;
-        length >>= 3;
+        int length = _width >> 3;
+        int mod = _width & 7;
 
-        // [vłЂ珈
-        for (int i = 0; i < length; ++i)
+        // s̖̗]͏Ȃ
+        for (int y = 0; y < _height; ++y)
         {
-            f(pixels[0]);
-            f(pixels[1]);
-            f(pixels[2]);
-            f(pixels[3]);
-            f(pixels[4]);
-            f(pixels[5]);
-            f(pixels[6]);
-            f(pixels[7]);
-
-            pixels += 8;
-        }
+            color *pixels = line;
 
-        for (int i = 0; i < mod; ++i)
-        {
-            f(pixels[i]);
+            // [vłЂ珈
+            for (int i = 0; i < length; ++i)
+            {
+                f(pixels[0]);
+                f(pixels[1]);
+                f(pixels[2]);
+                f(pixels[3]);
+                f(pixels[4]);
+                f(pixels[5]);
+                f(pixels[6]);
+                f(pixels[7]);
+
+                pixels += 8;
+            }
+
+            for (int i = 0; i < mod; ++i)
+            {
+                f(pixels[i]);
+            }
+
+            line += _stride;
         }
     }
     bool calc_clipping(int &x, int &y, int &sx, int &sy, int &width, int &height) const
@@ -343,8 +651,110 @@ public:
 
         return true;
     }
+private:
+    // s̐擪obt@v[mۂ
+    static std::shared_ptr<color> allocate(int width, int height, bool clear = true)
+    {
+        // TCY̌vZӂꂷꍇ͊mۂłȂ
+        if (!valid_size(width, height))
+        {
+            throw std::bad_alloc();
+        }
+        size_t length = static_cast<size_t>(pitch(width)) * height;
+        buffer_block block = buffer_pool::instance().allocate(length * sizeof(color));
+        color *p = static_cast<color *>(block.data);
+        if (clear)
+        {
+            std::uninitialized_fill_n(p, length, color());
+        }
+        return std::shared_ptr<color>(p, [block](color *) { buffer_pool::instance().release(block); });
+    }
+    // ꎞt@CɃ}bvobt@mۂA쐬łȂꍇ͋Ԃ
+    // gt@C 0 Ŗ߂Ă̂ŏ͕sv
+    static std::shared_ptr<color> allocate_mapped(int width, int height)
+    {
+        if (!valid_size(width, height))
+        {
+            return std::shared_ptr<color>();
+        }
+        unsigned long long length = static_cast<unsigned long long>(pitch(width)) * height;
+        std::shared_ptr<scratch_file> file = std::make_shared<scratch_file>();
+        if (!file->open(scratch_directory(), length * sizeof(color)))
+        {
+            return std::shared_ptr<color>();
+        }
+        // obt@ꂽ_Ńt@C
+        return std::shared_ptr<color>(reinterpret_cast<color *>(file->data()), [file](color *) { file->close(); });
+    }
+    static std::mutex &scratch_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static string_t &scratch_path()
+    {
+        static string_t directory;
+        return directory;
+    }
 private:
     int _width;
     int _height;
-    std::unique_ptr<color[]> _buffer;
-};
\ No newline at end of file
+    int _stride;
+    // obt@̐擪ŏ̃sNZ܂ł̈ʒu
+    size_t _offset;
+    bool _premultiplied;
+    bool _mapped;
+    // Rs[摜mŃobt@LAݎɕ
+    std::shared_ptr<color> _buffer;
+    // `lɕsNZ̃LbV
+    mutable std::shared_ptr<const planar_image> _planar;
+};
+
+// `̑SẴsNZ̉摜Tv[ŋ߂
+// src  pixel  pixel_no_check ŎQƂł΁Aimage ȊOłǂ
+template<class Source, class Sampler>
+void sample_image(const Source &src, image &dst, Sampler s)
+{
+    // TCY摜̃TCY擾
+    int width = dst.width();
+    int height = dst.height();
+
+    // sNZ̍őlvZ
+    int px_width = src.width() - 1;
+    int px_height = src.height() - 1;
+
+    // XP[vZ
+    double scale_x = static_cast<double>(width) / src.width();
+    double scale_y = static_cast<double>(height) / src.height();
+
+    // ̂߂ɈꎞIɃ|C^g
+    color *pixels = dst.buffer();
+    int stride = dst.stride();
+
+    // ۂ̏
+    for (int y = 0; y < height; ++y)
+    {
+        // ̂ߎOɌvZ
+        double calc_y = (y / scale_y);
+
+        // X Ƀ[v
+        for (int x = 0; x < width; ++x)
+        {
+            // IWił̈ʒuvZāAsampler ɏC
+            s(src, (x / scale_x), calc_y, px_width, px_height, pixels[x]);
+        }
+
+        // |C^ړ
+        pixels += stride;
+    }
+}
+
+// ς݂̃q[v OS ɕԂ
+inline void trim_memory()
+{
+#if defined(_MSC_VER)
+    _heapmin();
+#elif defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
\ No newline at end of file
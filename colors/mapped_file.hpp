@@ -0,0 +1,346 @@
+/*
+    mapped_file.hpp
+    COLORS Memory Mapped File Library
+*/
+
+#pragma once
+
+#include "saori.h"
+
+#ifndef _WINDOWS
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif /* _WINDOWS */
+
+// t@CǂݎpŃɃ}bv
+class mapped_file
+{
+public:
+    mapped_file()
+        : _data(NULL), _size(0), _modified(0)
+    {
+#ifdef _WINDOWS
+        _file = INVALID_HANDLE_VALUE;
+        _mapping = NULL;
+#endif /* _WINDOWS */
+    }
+    ~mapped_file()
+    {
+        close();
+    }
+    bool open(const string_t &file)
+    {
+        close();
+
+#ifdef _WINDOWS
+        _file = CreateFile(file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (_file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0 || static_cast<unsigned long long>(size.QuadPart) > static_cast<size_t>(-1))
+        {
+            close();
+            return false;
+        }
+
+        FILETIME modified;
+        if (!GetFileTime(_file, NULL, NULL, &modified))
+        {
+            close();
+            return false;
+        }
+
+        _mapping = CreateFileMapping(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (_mapping == NULL)
+        {
+            close();
+            return false;
+        }
+
+        _data = static_cast<unsigned char *>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (_data == NULL)
+        {
+            close();
+            return false;
+        }
+
+        _size = static_cast<size_t>(size.QuadPart);
+        _modified = (static_cast<unsigned long long>(modified.dwHighDateTime) << 32) | modified.dwLowDateTime;
+#else
+        FILE *fp;
+        if (tfopen_s(&fp, file.c_str(), _T("rb")) != 0)
+        {
+            return false;
+        }
+
+        // }bv̓t@CL
+        struct stat st;
+        if (fstat(fileno(fp), &st) != 0 || st.st_size <= 0)
+        {
+            fclose(fp);
+            return false;
+        }
+
+        void *data = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+
+        fclose(fp);
+
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        _data = static_cast<unsigned char *>(data);
+        _size = static_cast<size_t>(st.st_size);
+        _modified = stat_modified(st);
+#endif /* _WINDOWS */
+
+        return true;
+    }
+    void close()
+    {
+#ifdef _WINDOWS
+        if (_data != NULL)
+        {
+            UnmapViewOfFile(_data);
+        }
+        if (_mapping != NULL)
+        {
+            CloseHandle(_mapping);
+        }
+        if (_file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(_file);
+        }
+        _file = INVALID_HANDLE_VALUE;
+        _mapping = NULL;
+#else
+        if (_data != NULL)
+        {
+            munmap(_data, _size);
+        }
+#endif /* _WINDOWS */
+        _data = NULL;
+        _size = 0;
+        _modified = 0;
+    }
+    inline const unsigned char *data() const
+    {
+        return _data;
+    }
+    inline size_t size() const
+    {
+        return _size;
+    }
+    // ŏIXVAPʂ̓vbgtH[Ɉˑ
+    inline unsigned long long modified() const
+    {
+        return _modified;
+    }
+#ifndef _WINDOWS
+    // bPʂ st_mtime ł͓b̊ԂɏꂽƂȂ̂ŁAimb܂Ŏg
+    static unsigned long long stat_modified(const struct stat &st)
+    {
+#ifdef __APPLE__
+        return static_cast<unsigned long long>(st.st_mtimespec.tv_sec) * 1000000000ULL + st.st_mtimespec.tv_nsec;
+#else
+        return static_cast<unsigned long long>(st.st_mtim.tv_sec) * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif /* __APPLE__ */
+    }
+#endif /* _WINDOWS */
+private:
+    mapped_file(const mapped_file &);
+    mapped_file &operator=(const mapped_file &);
+private:
+#ifdef _WINDOWS
+    HANDLE _file;
+    HANDLE _mapping;
+#endif /* _WINDOWS */
+    unsigned char *_data;
+    size_t _size;
+    unsigned long long _modified;
+};
+
+// t@C̃TCYƍŏIXVAJɎ擾
+// t@Cꍇ͗Ƃ 0 ɂȂ
+inline void get_file_stamp(const string_t &file, size_t &size, unsigned long long &modified)
+{
+    size = 0;
+    modified = 0;
+
+#ifdef _WINDOWS
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (GetFileAttributesEx(file.c_str(), GetFileExInfoStandard, &data))
+    {
+        size = static_cast<size_t>((static_cast<unsigned long long>(data.nFileSizeHigh) << 32) | data.nFileSizeLow);
+        modified = (static_cast<unsigned long long>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+    }
+#else
+    struct stat st;
+    if (!file.empty() && stat(file.c_str(), &st) == 0)
+    {
+        size = static_cast<size_t>(st.st_size);
+        modified = mapped_file::stat_modified(st);
+    }
+#endif /* _WINDOWS */
+}
+
+// ǂݏłꎞt@CɃ}bv
+// Ɏ܂Ȃ摜̃obt@ɎgAƃt@C폜
+class scratch_file
+{
+public:
+    scratch_file()
+        : _data(NULL), _size(0)
+    {
+#ifdef _WINDOWS
+        _file = INVALID_HANDLE_VALUE;
+        _mapping = NULL;
+#endif /* _WINDOWS */
+    }
+    ~scratch_file()
+    {
+        close();
+    }
+    // directory  size oCg̃t@C쐬Ȁꍇ͈ꎞfBNgg
+    bool open(const string_t &directory, unsigned long long size)
+    {
+        close();
+
+        if (size == 0 || size > static_cast<size_t>(-1))
+        {
+            return false;
+        }
+
+#ifdef _WINDOWS
+        char_t path[MAX_PATH];
+        char_t temp[MAX_PATH];
+
+        if (directory.empty() && GetTempPath(MAX_PATH, temp) == 0)
+        {
+            return false;
+        }
+        if (GetTempFileName(directory.empty() ? temp : directory.c_str(), _T("clr"), 0, path) == 0)
+        {
+            return false;
+        }
+
+        // _ō폜
+        _file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (_file == INVALID_HANDLE_VALUE)
+        {
+            DeleteFile(path);
+            return false;
+        }
+
+        // }bsO̍쐬Ƀt@Cg
+        _mapping = CreateFileMapping(_file, NULL, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), NULL);
+        if (_mapping == NULL)
+        {
+            close();
+            return false;
+        }
+
+        _data = static_cast<unsigned char *>(MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+        if (_data == NULL)
+        {
+            close();
+            return false;
+        }
+#else
+        // /tmp ̓̃t@CVXȅꍇ̂ŁAł /var/tmp g
+        string_t path = directory;
+
+        if (path.empty())
+        {
+            const char *env = getenv("TMPDIR");
+            path = env != NULL ? env : "/var/tmp";
+        }
+
+        path += "/colors-XXXXXX";
+
+        int fd = mkstemp(&path[0]);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        // O͕svȂ̂ŁAJ܂܍폜Ă
+        unlink(path.c_str());
+
+        // ܂܂ŃfBXN͏Ȃ
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        void *data = mmap(NULL, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        ::close(fd);
+
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        // sPʂŐ擪珇ɏ̂ŁAǂ݂𑝂₵ēǂ񂾃y[W͑߂Ɏ
+        madvise(data, static_cast<size_t>(size), MADV_SEQUENTIAL);
+
+        _data = static_cast<unsigned char *>(data);
+#endif /* _WINDOWS */
+
+        _size = static_cast<size_t>(size);
+
+        return true;
+    }
+    void close()
+    {
+#ifdef _WINDOWS
+        if (_data != NULL)
+        {
+            UnmapViewOfFile(_data);
+        }
+        if (_mapping != NULL)
+        {
+            CloseHandle(_mapping);
+        }
+        if (_file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(_file);
+        }
+        _file = INVALID_HANDLE_VALUE;
+        _mapping = NULL;
+#else
+        if (_data != NULL)
+        {
+            munmap(_data, _size);
+        }
+#endif /* _WINDOWS */
+        _data = NULL;
+        _size = 0;
+    }
+    inline unsigned char *data() const
+    {
+        return _data;
+    }
+    inline size_t size() const
+    {
+        return _size;
+    }
+private:
+    scratch_file(const scratch_file &);
+    scratch_file &operator=(const scratch_file &);
+private:
+#ifdef _WINDOWS
+    HANDLE _file;
+    HANDLE _mapping;
+#endif /* _WINDOWS */
+    unsigned char *_data;
+    size_t _size;
+};
\ No newline at end of file
@@ -0,0 +1,158 @@
+/*
+    mask.hpp
+    COLORS Alpha Mask Library
+*/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "allocator.hpp"
+#include "image.hpp"
+#include "png.hpp"
+
+// At@`l 1 sNZ 1 oCgŕێ摜
+// eⓖ蔻̂悤ɐFȂfނɎgAƑш 1/4 ɗ}
+class alpha_mask
+{
+public:
+    alpha_mask()
+        : _width(0), _height(0), _stride(0)
+    {
+    }
+    inline int width() const
+    {
+        return _width;
+    }
+    inline int height() const
+    {
+        return _height;
+    }
+    // s̐擪玟̍s̐擪܂ł̃oCg
+    inline int stride() const
+    {
+        return _stride;
+    }
+    // gpĂ郁
+    inline size_t bytes() const
+    {
+        return static_cast<size_t>(_stride) * _height;
+    }
+    inline unsigned char *row(int y)
+    {
+        return _buffer.get() + static_cast<size_t>(_stride) * y;
+    }
+    inline const unsigned char *row(int y) const
+    {
+        return _buffer.get() + static_cast<size_t>(_stride) * y;
+    }
+    // W̃At@l擾ÄO͓ɂȂ
+    inline unsigned char alpha(int x, int y) const
+    {
+        if (x >= 0 && x < _width && y >= 0 && y < _height)
+        {
+            return row(y)[x];
+        }
+        return 0;
+    }
+    // SẴsNZޏꍇ clear  false ɂďȗł
+    bool resize(int width, int height, bool clear = true)
+    {
+        if (width <= 0 || height <= 0)
+        {
+            return false;
+        }
+
+        // s̐擪 row_alignment ɑ
+        int stride = (width + row_alignment - 1) / row_alignment * row_alignment;
+
+        buffer_block block = buffer_pool::instance().allocate(static_cast<size_t>(stride) * height);
+
+        unsigned char *p = static_cast<unsigned char *>(block.data);
+
+        if (clear)
+        {
+            memset(p, 0, static_cast<size_t>(stride) * height);
+        }
+
+        _width = width;
+        _height = height;
+        _stride = stride;
+        _buffer = std::shared_ptr<unsigned char>(p, [block](unsigned char *) { buffer_pool::instance().release(block); });
+
+        return true;
+    }
+    // 摜̃At@`l쐬
+    // Zς݃At@łAt@l͕ςȂ̂ŁAǂ̌`łʂɂȂ
+    bool assign(const image &src)
+    {
+        if (!resize(src.width(), src.height(), false))
+        {
+            return false;
+        }
+
+        for (int y = 0; y < _height; ++y)
+        {
+            const color *p = src.row(y);
+            unsigned char *q = row(y);
+
+            for (int x = 0; x < _width; ++x)
+            {
+                q[x] = static_cast<unsigned char>(p[x].alpha());
+            }
+        }
+        return true;
+    }
+    // 1 sƃAt@̃sNZɓWJA͏Zς݂łlɂȂ
+    void expand_row(color *dst, int y) const
+    {
+        const unsigned char *p = row(y);
+
+        for (int x = 0; x < _width; ++x)
+        {
+            dst[x] = color(p[x], 0, 0, 0);
+        }
+    }
+    // ʏ̉摜ɓWJ
+    bool expand(image &dst) const
+    {
+        if (!dst.resize(_width, _height, false))
+        {
+            return false;
+        }
+
+        for (int y = 0; y < _height; ++y)
+        {
+            expand_row(dst.row(y), y);
+        }
+        return true;
+    }
+private:
+    int _width;
+    int _height;
+    int _stride;
+    std::shared_ptr<unsigned char> _buffer;
+};
+
+// }XNƃAt@̉摜Ƃ 1 so
+bool png_save_image(const string_t &file, const alpha_mask &src)
+{
+    png_writer writer;
+
+    if (!writer.open(file, src.width(), src.height()))
+    {
+        return false;
+    }
+
+    std::vector<color> row(src.width());
+
+    for (int i = 0; i < src.height(); ++i)
+    {
+        src.expand_row(&row[0], i);
+
+        writer.write_row(&row[0]);
+    }
+
+    return writer.close();
+}
\ No newline at end of file
@@ -0,0 +1,260 @@
+/*
+    palette.hpp
+    COLORS Indexed Image Library
+*/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "allocator.hpp"
+#include "image.hpp"
+#include "png.hpp"
+
+// pbg̔ԍ̍sAYŃpbg̐FԂsƂĈ
+class palette_row
+{
+public:
+    palette_row(const unsigned char *indices, const color *palette)
+        : _indices(indices), _palette(palette)
+    {
+    }
+    inline const color &operator[](int index) const
+    {
+        return _palette[_indices[index]];
+    }
+private:
+    const unsigned char *_indices;
+    const color *_palette;
+};
+
+// pbg̔ԍ 1 sNZ 1 oCgŕێ摜
+// F̕ύX̓pbg邾ōς݁AsNZ͓ǂݍ݌ɕύXȂ
+class indexed_image
+{
+public:
+    static const int palette_size = 256;
+
+    indexed_image()
+        : _width(0), _height(0), _stride(0), _premultiplied(false), _palette(palette_size)
+    {
+    }
+    inline int width() const
+    {
+        return _width;
+    }
+    inline int height() const
+    {
+        return _height;
+    }
+    // s̐擪玟̍s̐擪܂ł̃oCg
+    inline int stride() const
+    {
+        return _stride;
+    }
+    // gpĂ郁
+    inline size_t bytes() const
+    {
+        return static_cast<size_t>(_stride) * _height + _palette.size() * sizeof(color);
+    }
+    inline bool premultiplied() const
+    {
+        return _premultiplied;
+    }
+    // ԍ͏݌ɕύXȂ̂ŁA摜mŋL
+    inline unsigned char *row(int y)
+    {
+        return _indices.get() + static_cast<size_t>(_stride) * y;
+    }
+    inline const unsigned char *row(int y) const
+    {
+        return _indices.get() + static_cast<size_t>(_stride) * y;
+    }
+    inline color *palette()
+    {
+        return &_palette[0];
+    }
+    inline const color *palette() const
+    {
+        return &_palette[0];
+    }
+    // Tv[ image Ɠ悤ɎQƂł悤ɂ
+    inline const color &pixel(int x, int y) const
+    {
+        if (x >= 0 && x < _width && y >= 0 && y < _height)
+        {
+            return _palette[row(y)[x]];
+        }
+        return _palette[row(0)[0]];
+    }
+    inline const color &pixel_no_check(int x, int y) const
+    {
+        return _palette[row(y)[x]];
+    }
+    // SĂ̔ԍޏꍇ clear  false ɂďȗł
+    bool resize(int width, int height, bool clear = true)
+    {
+        if (width <= 0 || height <= 0)
+        {
+            return false;
+        }
+
+        // s̐擪 row_alignment ɑ
+        int stride = (width + row_alignment - 1) / row_alignment * row_alignment;
+
+        buffer_block block = buffer_pool::instance().allocate(static_cast<size_t>(stride) * height);
+
+        unsigned char *p = static_cast<unsigned char *>(block.data);
+
+        if (clear)
+        {
+            memset(p, 0, static_cast<size_t>(stride) * height);
+        }
+
+        _width = width;
+        _height = height;
+        _stride = stride;
+        _indices = std::shared_ptr<unsigned char>(p, [block](unsigned char *) { buffer_pool::instance().release(block); });
+
+        return true;
+    }
+    // pbg̑SĂ̐FϊAsNZɊ֌WȂpbg̑傫ōς
+    template<class Function>
+    void transform(Function f)
+    {
+        for (auto it = _palette.begin(); it != _palette.end(); ++it)
+        {
+            f(*it);
+        }
+    }
+    void premultiply()
+    {
+        if (!_premultiplied)
+        {
+            const alpha_table &table = alpha_table::instance();
+            transform([&table](color &pixel) { pixel = premultiply_color(pixel, table); });
+            _premultiplied = true;
+        }
+    }
+    void unpremultiply()
+    {
+        if (_premultiplied)
+        {
+            const alpha_table &table = alpha_table::instance();
+            transform([&table](color &pixel) { pixel = unpremultiply_color(pixel, table); });
+            _premultiplied = false;
+        }
+    }
+    // 1 spbg̐FɓWJ
+    void expand_row(color *dst, int y) const
+    {
+        const unsigned char *p = row(y);
+        const color *colors = palette();
+
+        for (int x = 0; x < _width; ++x)
+        {
+            dst[x] = colors[p[x]];
+        }
+    }
+    // ʏ̉摜ɓWJ
+    bool expand(image &dst) const
+    {
+        if (!dst.resize(_width, _height, false))
+        {
+            return false;
+        }
+
+        dst.premultiplied(_premultiplied);
+
+        for (int y = 0; y < _height; ++y)
+        {
+            expand_row(dst.row(y), y);
+        }
+        return true;
+    }
+    // ꕔ𓯂pbg̉摜ƂĐ؂o
+    bool sub_image(indexed_image &dst, int x, int y, int width, int height) const
+    {
+        int left = std::max(x, 0);
+        int top = std::max(y, 0);
+        int right = std::min(x + width, _width);
+        int bottom = std::min(y + height, _height);
+
+        if (left >= right || top >= bottom || !dst.resize(right - left, bottom - top, false))
+        {
+            return false;
+        }
+
+        for (int i = top; i < bottom; ++i)
+        {
+            memcpy(dst.row(i - top), row(i) + left, right - left);
+        }
+
+        dst._palette = _palette;
+        dst._premultiplied = _premultiplied;
+
+        return true;
+    }
+    // pbg` PNG pbĝ܂ܓǂݍށAȊǑ`̏ꍇ false Ԃ
+    bool load(const string_t &file)
+    {
+        png_reader reader;
+
+        if (!reader.open_indexed(file) || !resize(reader.width(), reader.height(), false))
+        {
+            return false;
+        }
+
+        std::fill(_palette.begin(), _palette.end(), color());
+
+        reader.read_palette(palette());
+
+        for (int y = 0; y < _height; ++y)
+        {
+            if (!reader.read_indices(row(y)))
+            {
+                return false;
+            }
+        }
+
+        _premultiplied = false;
+
+        return true;
+    }
+private:
+    int _width;
+    int _height;
+    int _stride;
+    bool _premultiplied;
+    std::shared_ptr<unsigned char> _indices;
+    std::vector<color> _palette;
+};
+
+// pbg̐FɓWJȂ 1 so
+bool png_save_image(const string_t &file, const indexed_image &src)
+{
+    png_writer writer;
+
+    if (!writer.open(file, src.width(), src.height()))
+    {
+        return false;
+    }
+
+    // Zς݃At@̏ꍇ́AԍL܂܃pbgXg[gAt@ɖ߂
+    indexed_image straight(src);
+
+    straight.unpremultiply();
+
+    std::vector<color> row(src.width());
+
+    for (int i = 0; i < src.height(); ++i)
+    {
+        straight.expand_row(&row[0], i);
+
+        writer.write_row(&row[0]);
+    }
+
+    return writer.close();
+}
\ No newline at end of file
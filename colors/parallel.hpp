@@ -0,0 +1,154 @@
+/*
+    parallel.hpp
+    COLORS Parallel Processing Library
+*/
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Œ萔̃XbhŃ^XN郏[J[v[
+class worker_pool
+{
+public:
+    // ^XNɂ͏郏[J[̔ԍn
+    typedef std::function<void(int)> task_type;
+
+    explicit worker_pool(int count = 0)
+        : _running(0), _stopping(false)
+    {
+        if (count <= 0)
+        {
+            count = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            _threads.push_back(std::thread(&worker_pool::run, this, i));
+        }
+    }
+    ~worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+
+        _task_ready.notify_all();
+
+        for (auto it = _threads.begin(); it != _threads.end(); ++it)
+        {
+            it->join();
+        }
+    }
+    inline int size() const
+    {
+        return static_cast<int>(_threads.size());
+    }
+    void post(task_type task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.push_back(std::move(task));
+        }
+
+        _task_ready.notify_one();
+    }
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // L[ɂȂASẴ^XNI܂ő҂
+        _task_done.wait(lock, [this] { return _tasks.empty() && _running == 0; });
+    }
+private:
+    worker_pool(const worker_pool &);
+    worker_pool &operator=(const worker_pool &);
+    void run(int index)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true)
+        {
+            _task_ready.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+
+            if (_tasks.empty())
+            {
+                // ~vA^XNcĂȂ
+                return;
+            }
+
+            task_type task = std::move(_tasks.front());
+            _tasks.pop_front();
+
+            _running += 1;
+
+            lock.unlock();
+
+            // ^XNoOŃXbhƏIȂ悤ɁAŎ~߂
+            // ʂԂKv^XŃAŗO󂯎~߂ĎsL^邱
+            try
+            {
+                task(index);
+            }
+            catch (...)
+            {
+            }
+
+            lock.lock();
+
+            _running -= 1;
+
+            if (_tasks.empty() && _running == 0)
+            {
+                _task_done.notify_all();
+            }
+        }
+    }
+private:
+    std::vector<std::thread> _threads;
+    std::deque<task_type> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _task_ready;
+    std::condition_variable _task_done;
+    int _running;
+    bool _stopping;
+};
+
+// ^XN̐𐔂ASďI܂ő҂
+// L̃[J[v[ŁAĂяoɎ̃^XN҂߂Ɏg
+class task_latch
+{
+public:
+    explicit task_latch(int count)
+        : _count(count)
+    {
+    }
+    void count_down()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (--_count == 0)
+        {
+            _done.notify_all();
+        }
+    }
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _count <= 0; });
+    }
+private:
+    task_latch(const task_latch &);
+    task_latch &operator=(const task_latch &);
+private:
+    std::mutex _mutex;
+    std::condition_variable _done;
+    int _count;
+};
\ No newline at end of file
@@ -5,138 +5,576 @@
 
 #pragma once
 
+#include <vector>
+#include <memory>
+#include <csetjmp>
+
 #include <png.h>
+#include <zlib.h>
 
 #include "saori.h"
 #include "image.hpp"
 
-bool png_load_image(const string_t &file, image &src)
+// libpng ̃G[̓bZ[WoɁAsetjmp ʒuɖ߂
+inline void png_error_handler(png_structp png_ptr, png_const_charp message)
 {
-    FILE *fp;
-    if (tfopen_s(&fp, file.c_str(), _T("rb")) != 0)
-    {
-        return false;
-    }
+    png_longjmp(png_ptr, 1);
+}
 
-    png_uint_32 width, height;
-    int depth, colortype;
+// x͖
+inline void png_warning_handler(png_structp png_ptr, png_const_charp message)
+{
+}
 
-    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (png_ptr == NULL)
+// 1 sfR[h PNG [_[
+class png_reader
+{
+public:
+    png_reader()
+        : _fp(NULL), _png_ptr(NULL), _info_ptr(NULL), _width(0), _height(0), _channels(4), _interlaced(false), _row(0)
     {
-        fclose(fp);
-        return false;
     }
-
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL)
+    ~png_reader()
     {
-        fclose(fp);
-        png_destroy_read_struct(&png_ptr, NULL, NULL);
-        return false;
+        close();
+    }
+    bool open(const string_t &file)
+    {
+        return open(file, format_rgba);
     }
+    // pbg` PNG pbg̔ԍ̂܂ܓǂݍށAȊǑ`͊JȂ
+    bool open_indexed(const string_t &file)
+    {
+        return open(file, format_indexed);
+    }
+    // TCỸO[XP[摜At@`lƂēǂݍ
+    bool open_mask(const string_t &file)
+    {
+        if (_png_ptr == NULL || _row != 0)
+        {
+            return false;
+        }
+
+        std::unique_ptr<png_reader> mask(new png_reader());
 
-    png_init_io(png_ptr, fp);
-    png_read_info(png_ptr, info_ptr);
-    png_get_IHDR(png_ptr, info_ptr, &width, &height, &depth, &colortype, NULL, NULL, NULL);
+        if (!mask->open(file, format_gray) || mask->width() != _width || mask->height() != _height)
+        {
+            return false;
+        }
 
-    // obt@m
-    src.resize(width, height);
+        _mask = std::move(mask);
+        _mask_row.resize(_width);
 
-    // fR[h
-    color *buffer = src.buffer();
-    png_bytepp pp = new png_bytep[height];
-    for (png_uint_32 i = 0; i < height; ++i)
+        return true;
+    }
+    void close()
     {
-        pp[i] = reinterpret_cast<png_bytep>(&buffer[width * i]);
+        if (_png_ptr != NULL)
+        {
+            png_destroy_read_struct(&_png_ptr, _info_ptr != NULL ? &_info_ptr : NULL, NULL);
+        }
+        if (_fp != NULL)
+        {
+            fclose(_fp);
+        }
+        _fp = NULL;
+        _png_ptr = NULL;
+        _info_ptr = NULL;
+        _frame.clear();
+        _mask.reset();
     }
-
-    // ǂݍݐݒ
-    if (colortype == PNG_COLOR_TYPE_PALETTE)
+    inline int width() const
     {
-        png_set_palette_to_rgb(png_ptr);
+        return _width;
     }
-    if (colortype == PNG_COLOR_TYPE_GRAY && depth < 8)
+    inline int height() const
     {
-        png_set_expand_gray_1_2_4_to_8(png_ptr);
+        return _height;
     }
-    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+    bool read_row(color *row)
     {
-        png_set_tRNS_to_alpha(png_ptr);
+        if (!read_row(reinterpret_cast<png_bytep>(row)))
+        {
+            return false;
+        }
+
+        if (_mask)
+        {
+            // }XN̓sfR[hāAZŴ܂܃At@lɂ
+            if (!_mask->read_row(&_mask_row[0]))
+            {
+                return false;
+            }
+
+            for (int i = 0; i < _width; ++i)
+            {
+                row[i].alpha(_mask_row[i]);
+            }
+        }
+
+        return true;
     }
-    if (colortype != PNG_COLOR_TYPE_RGBA)
+    // pbgǂݍށAߐF̓At@lɂȂ
+    // palette ɂ 256 F̗̈悪KvŁAgĂȂF͕ύXȂ
+    int read_palette(color *palette)
     {
-        png_set_add_alpha(png_ptr, 255, PNG_FILLER_AFTER);
+        png_colorp entries;
+        int count = 0;
+
+        if (_png_ptr == NULL || png_get_PLTE(_png_ptr, _info_ptr, &entries, &count) == 0)
+        {
+            return 0;
+        }
+
+        png_bytep alpha = NULL;
+        int alpha_count = 0;
+
+        if (png_get_valid(_png_ptr, _info_ptr, PNG_INFO_tRNS))
+        {
+            png_get_tRNS(_png_ptr, _info_ptr, &alpha, &alpha_count, NULL);
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            palette[i] = color(i < alpha_count ? alpha[i] : 255, entries[i].red, entries[i].green, entries[i].blue);
+        }
+
+        return count;
     }
-    if (depth == 16)
+    // pbg̔ԍ 1 sǂݍ
+    bool read_indices(unsigned char *row)
     {
-        png_set_strip_16(png_ptr);
+        return read_row(static_cast<png_bytep>(row));
     }
+    bool read_image(image &dst)
+    {
+        if (_png_ptr == NULL || _row != 0)
+        {
+            return false;
+        }
 
-    png_read_update_info(png_ptr, info_ptr);
+        // obt@m
+        // SĂ̍sނ̂ŏȂ
+        if (!dst.resize(_width, _height, false))
+        {
+            return false;
+        }
 
-    // t@Cǂݍ
-    png_read_image(png_ptr, pp);
+        // }XNꍇ 1 sȂfR[h
+        if (_mask)
+        {
+            for (int i = 0; i < _height; ++i)
+            {
+                if (!read_row(dst.row(i)))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
 
-    // I
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        // fR[h
+        std::vector<png_bytep> pp(_height);
+        for (int i = 0; i < _height; ++i)
+        {
+            pp[i] = reinterpret_cast<png_bytep>(dst.row(i));
+        }
+
+        // ꂽt@CrŐ؂ꂽt@C͂ɖ߂Ă
+        if (setjmp(png_jmpbuf(_png_ptr)))
+        {
+            close();
+            return false;
+        }
+
+        // t@Cǂݍ
+        png_read_image(_png_ptr, &pp[0]);
+
+        _row = _height;
+
+        return true;
+    }
+private:
+    png_reader(const png_reader &);
+    png_reader &operator=(const png_reader &);
+    // ǂݍ݌̃sNŽ`
+    enum pixel_format
+    {
+        format_rgba,
+        format_gray,
+        format_indexed
+    };
+    bool open(const string_t &file, pixel_format format)
+    {
+        close();
+
+        if (tfopen_s(&_fp, file.c_str(), _T("rb")) != 0)
+        {
+            _fp = NULL;
+            return false;
+        }
+
+        _png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, png_error_handler, png_warning_handler);
+        if (_png_ptr == NULL)
+        {
+            close();
+            return false;
+        }
+
+        _info_ptr = png_create_info_struct(_png_ptr);
+        if (_info_ptr == NULL)
+        {
+            close();
+            return false;
+        }
+
+        png_uint_32 width, height;
+        int depth, colortype, interlace;
+
+        // wb_Ăꍇ͂ɖ߂Ă
+        if (setjmp(png_jmpbuf(_png_ptr)))
+        {
+            close();
+            return false;
+        }
+
+        png_init_io(_png_ptr, _fp);
+        png_read_info(_png_ptr, _info_ptr);
+        png_get_IHDR(_png_ptr, _info_ptr, &width, &height, &depth, &colortype, &interlace, NULL, NULL);
+
+        if (format == format_indexed)
+        {
+            if (colortype != PNG_COLOR_TYPE_PALETTE)
+            {
+                close();
+                return false;
+            }
+
+            // 8bit ̔ԍ 1 oCgɍL
+            if (depth < 8)
+            {
+                png_set_packing(_png_ptr);
+            }
+            _channels = 1;
+        }
+        // ǂݍݐݒ
+        else if (colortype == PNG_COLOR_TYPE_PALETTE)
+        {
+            png_set_palette_to_rgb(_png_ptr);
+        }
+        if (colortype == PNG_COLOR_TYPE_GRAY && depth < 8)
+        {
+            png_set_expand_gray_1_2_4_to_8(_png_ptr);
+        }
+        if (depth == 16)
+        {
+            png_set_strip_16(_png_ptr);
+        }
+
+        if (format == format_gray)
+        {
+            // }XN 8bit O[XP[ɂ
+            if (colortype & PNG_COLOR_MASK_COLOR)
+            {
+                png_set_rgb_to_gray_fixed(_png_ptr, 1, -1, -1);
+            }
+            if (colortype & PNG_COLOR_MASK_ALPHA)
+            {
+                png_set_strip_alpha(_png_ptr);
+            }
+            _channels = 1;
+        }
+        else if (format == format_rgba)
+        {
+            if (colortype == PNG_COLOR_TYPE_GRAY || colortype == PNG_COLOR_TYPE_GRAY_ALPHA)
+            {
+                png_set_gray_to_rgb(_png_ptr);
+            }
+            if (png_get_valid(_png_ptr, _info_ptr, PNG_INFO_tRNS))
+            {
+                png_set_tRNS_to_alpha(_png_ptr);
+            }
+            if (colortype != PNG_COLOR_TYPE_RGBA)
+            {
+                png_set_add_alpha(_png_ptr, 255, PNG_FILLER_AFTER);
+            }
+            _channels = 4;
+        }
+
+        _interlaced = interlace != PNG_INTERLACE_NONE;
+        if (_interlaced)
+        {
+            png_set_interlace_handling(_png_ptr);
+        }
+
+        png_read_update_info(_png_ptr, _info_ptr);
+
+        _width = static_cast<int>(width);
+        _height = static_cast<int>(height);
+        _row = 0;
+
+        return true;
+    }
+    bool read_row(png_bytep row)
+    {
+        if (_png_ptr == NULL || _row >= _height)
+        {
+            return false;
+        }
+
+        size_t row_bytes = static_cast<size_t>(_width) * _channels;
 
-    fclose(fp);
-    delete[] pp;
+        if (_interlaced)
+        {
+            // C^[[X摜͍sPʂŊm肵Ȃ̂ŁAŏɑŜfR[hĂ
+            if (_frame.empty())
+            {
+                _frame.resize(row_bytes * _height);
 
-    return true;
+                std::vector<png_bytep> pp(_height);
+                for (int i = 0; i < _height; ++i)
+                {
+                    pp[i] = &_frame[row_bytes * i];
+                }
+
+                if (setjmp(png_jmpbuf(_png_ptr)))
+                {
+                    close();
+                    return false;
+                }
+
+                png_read_image(_png_ptr, &pp[0]);
+            }
+
+            memcpy(row, &_frame[row_bytes * _row], row_bytes);
+        }
+        else
+        {
+            // rŐ؂ꂽt@C͂ɖ߂Ă
+            if (setjmp(png_jmpbuf(_png_ptr)))
+            {
+                close();
+                return false;
+            }
+
+            png_read_row(_png_ptr, row, NULL);
+        }
+
+        _row += 1;
+
+        return true;
+    }
+private:
+    FILE *_fp;
+    png_structp _png_ptr;
+    png_infop _info_ptr;
+    int _width;
+    int _height;
+    int _channels;
+    bool _interlaced;
+    int _row;
+    std::vector<png_byte> _frame;
+    std::unique_ptr<png_reader> _mask;
+    std::vector<png_byte> _mask_row;
+};
+
+// 摜t@CɑΉAt@}XN (PNA) ̃t@C擾
+string_t png_mask_file(const string_t &file)
+{
+    string_t::size_type separator = file.find_last_of(_T("\\/"));
+    string_t::size_type dot = file.rfind(_T('.'));
+
+    // gq pna ɒu
+    string_t mask = (dot == string_t::npos || (separator != string_t::npos && dot < separator)) ? file + _T(".pna") : file.substr(0, dot) + _T(".pna");
+
+    // PNA ̂ǂݍޏꍇ̓}XNgȂ
+    // Windows ł̓t@C̑啶ƏʂȂ̂ŁAgq͋ʂɔׂ
+    if (mask.size() == file.size())
+    {
+        bool same = true;
+        for (string_t::size_type i = 0; i < mask.size() && same; ++i)
+        {
+            char_t a = mask[i];
+            char_t b = file[i];
+            same = a == b || (b >= _T('A') && b <= _T('Z') && a == b - _T('A') + _T('a'));
+        }
+        if (same)
+        {
+            return string_t();
+        }
+    }
+    return mask;
 }
 
-bool png_save_image(const string_t &file, image &src)
+// 1 sGR[h PNG C^[
+class png_writer
 {
-    FILE *fp;
-    if (tfopen_s(&fp, file.c_str(), _T("wb")) != 0)
+public:
+    png_writer()
+        : _fp(NULL), _png_ptr(NULL), _info_ptr(NULL), _height(0), _row(0)
     {
-        return false;
     }
+    ~png_writer()
+    {
+        close();
+    }
+    bool open(const string_t &file, int width, int height)
+    {
+        close();
+
+        if (width <= 0 || height <= 0)
+        {
+            return false;
+        }
+
+        if (tfopen_s(&_fp, file.c_str(), _T("wb")) != 0)
+        {
+            _fp = NULL;
+            return false;
+        }
+
+        _png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, png_error_handler, png_warning_handler);
+        if (_png_ptr == NULL)
+        {
+            close();
+            return false;
+        }
 
-    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (png_ptr == NULL)
+        _info_ptr = png_create_info_struct(_png_ptr);
+        if (_info_ptr == NULL)
+        {
+            close();
+            return false;
+        }
+
+        // ݂Ɏsꍇ͂ɖ߂Ă
+        if (setjmp(png_jmpbuf(_png_ptr)))
+        {
+            close();
+            return false;
+        }
+
+        // ݏ
+        png_init_io(_png_ptr, _fp);
+        png_set_IHDR(_png_ptr, _info_ptr, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_set_filter(_png_ptr, 0, PNG_NO_FILTERS);
+        png_set_compression_level(_png_ptr, Z_BEST_SPEED);
+        png_write_info(_png_ptr, _info_ptr);
+
+        _height = height;
+        _row = 0;
+
+        return true;
+    }
+    bool write_row(const color *row)
     {
-        fclose(fp);
-        return false;
+        if (_png_ptr == NULL || _row >= _height)
+        {
+            return false;
+        }
+
+        if (setjmp(png_jmpbuf(_png_ptr)))
+        {
+            close();
+            return false;
+        }
+
+        png_write_row(_png_ptr, reinterpret_cast<png_bytep>(const_cast<color *>(row)));
+
+        _row += 1;
+
+        // SĂ̍s񂾂Is
+        if (_row == _height)
+        {
+            png_write_end(_png_ptr, _info_ptr);
+        }
+
+        return true;
     }
+    bool close()
+    {
+        bool completed = _png_ptr != NULL && _row == _height;
+
+        if (_png_ptr != NULL)
+        {
+            png_destroy_write_struct(&_png_ptr, _info_ptr != NULL ? &_info_ptr : NULL);
+        }
+        if (_fp != NULL)
+        {
+            fclose(_fp);
+        }
+        _fp = NULL;
+        _png_ptr = NULL;
+        _info_ptr = NULL;
 
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL)
+        return completed;
+    }
+private:
+    png_writer(const png_writer &);
+    png_writer &operator=(const png_writer &);
+private:
+    FILE *_fp;
+    png_structp _png_ptr;
+    png_infop _info_ptr;
+    int _height;
+    int _row;
+};
+
+bool png_load_image(const string_t &file, image &src)
+{
+    png_reader reader;
+
+    // t@CJ
+    if (!reader.open(file))
     {
-        fclose(fp);
-        png_destroy_write_struct(&png_ptr, NULL);
         return false;
     }
 
-    png_uint_32 width = src.width();
-    png_uint_32 height = src.height();
+    // At@}XNΈꏏɓǂݍ
+    reader.open_mask(png_mask_file(file));
+
+    // t@Cǂݍ
+    return reader.read_image(src);
+}
+
+bool png_save_image(const string_t &file, const image &src)
+{
+    png_writer writer;
 
-    // obt@
-    color *buffer = src.buffer();
-    png_bytepp pp = new png_bytep[height];
-    for (png_uint_32 i = 0; i < height; ++i)
+    // t@CJ
+    if (!writer.open(file, src.width(), src.height()))
     {
-        pp[i] = reinterpret_cast<png_bytep>(&buffer[width * i]);
+        return false;
     }
 
-    // ݏ
-    png_init_io(png_ptr, fp);
-    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-    png_set_filter(png_ptr, 0, PNG_NO_FILTERS);
-    png_set_compression_level(png_ptr, Z_BEST_SPEED);
-    png_write_info(png_ptr, info_ptr);
+    // Zς݃At@̏ꍇ 1 sXg[gAt@ɖ߂ď
+    if (src.premultiplied())
+    {
+        const alpha_table &table = alpha_table::instance();
 
-    // t@Cɏ
-    png_write_image(png_ptr, pp);
+        std::vector<color> row(src.width());
 
-    // I
-    png_write_end(png_ptr, info_ptr);
-    png_destroy_write_struct(&png_ptr, &info_ptr);
+        for (int i = 0; i < src.height(); ++i)
+        {
+            const color *p = src.row(i);
+
+            for (int j = 0; j < src.width(); ++j)
+            {
+                row[j] = unpremultiply_color(p[j], table);
+            }
 
-    fclose(fp);
-    delete[] pp;
+            writer.write_row(&row[0]);
+        }
 
-    return true;
+        return writer.close();
+    }
+
+    // t@Cɏ
+    for (int i = 0; i < src.height(); ++i)
+    {
+        writer.write_row(src.row(i));
+    }
+
+    // I
+    return writer.close();
 }
\ No newline at end of file
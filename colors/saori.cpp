@@ -4,46 +4,97 @@
 */
 
 #include "saori.h"
+#include "parallel.hpp"
 
 // B SAORI CX^X
 static std::unique_ptr<saori> instance;
 
-bool saori_input::deserialize(string_t req)
-{
-    istringstream_t stream(req);
-    string_t line;
+// ob`NGXgŃR}h؂
+static constexpr string_view_t batch_separator = _T(";");
+
+// ̔ԍ̏AsȔԍŋȔzmۂȂ悤ɂ
+static const unsigned int max_arguments = 65536;
 
-    std::getline(stream, line);
-    string_t::size_type proto_pos = line.find(_T(" SAORI/1."));
-    if (proto_pos == string_t::npos)
+// ASCII ͈̔͂ő啶Əʂɔr
+static bool equals_ignore_case(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
     {
         return false;
     }
+    for (std::string_view::size_type i = 0; i < a.size(); ++i)
+    {
+        if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
-    command = line.substr(0, proto_pos);
+// NGXg 1 sāAeڂ͌̕QƂ܂܎o
+bool saori_input::deserialize(string_view_t req)
+{
+    command = string_view_t();
+    function = string_view_t();
+    args.clear();
+    opts.clear();
+
+    bool header = true;
 
-    while (std::getline(stream, line))
+    for (string_view_t::size_type begin = 0; begin < req.size();)
     {
-        string_t::size_type pos = line.find(_T(": "));
-        if (pos != string_t::npos)
+        string_view_t::size_type end = req.find(_T('\n'), begin);
+        if (end == string_view_t::npos)
         {
-            string_t key = line.substr(0, pos);
-            string_t value = line.substr(pos + 2, line.size() - pos - 3);
+            end = req.size();
+        }
+
+        string_view_t line = req.substr(begin, end - begin);
+        begin = end + 1;
 
-            if (key.compare(0, 8, _T("Argument")) == 0)
+        // 1 sڂ̓R}hƃvgR
+        if (header)
+        {
+            string_view_t::size_type proto_pos = line.find(_T(" SAORI/1."));
+            if (proto_pos == string_view_t::npos)
             {
+                return false;
+            }
 
-#ifdef _SAORI_UNICODE
-                unsigned int order = wtoi(key.c_str() + 8);
-#else
-                unsigned int order = atoi(key.c_str() + 8);
-#endif /* _SAORI_UNICODE */
+            command = line.substr(0, proto_pos);
+            header = false;
+            continue;
+        }
+
+        if (!line.empty() && line.back() == _T('\r'))
+        {
+            line.remove_suffix(1);
+        }
+
+        string_view_t::size_type pos = line.find(_T(": "));
+        if (pos != string_view_t::npos)
+        {
+            string_view_t key = line.substr(0, pos);
+            string_view_t value = line.substr(pos + 2);
+
+            if (key.size() > 8 && key.compare(0, 8, _T("Argument")) == 0)
+            {
+                // ԍ̐ǂ
+                unsigned int order = 0;
+                string_view_t::size_type digits = 8;
+
+                while (digits < key.size() && key[digits] >= _T('0') && key[digits] <= _T('9') && order < max_arguments)
+                {
+                    order = order * 10 + (key[digits] - _T('0'));
+                    digits += 1;
+                }
 
                 if (order == 0 && key[8] == _T('0'))
                 {
                     function = value;
                 }
-                else if (order > 0)
+                else if (order > 0 && order <= max_arguments)
                 {
                     if (args.size() < order)
                     {
@@ -56,118 +107,579 @@ bool saori_input::deserialize(string_t req)
             {
                 if (pos > 0)
                 {
-                    opts[key] = value;
+                    opts.emplace_back(key, value);
                 }
             }
         }
     }
-    return true;
+    return !header;
 }
 
-string_t saori_output::serialize()
+// X|X̒𐔂邾ŏ܂Ȃ
+class response_counter
 {
-    string_t rc_str = saori::from_result(result_code);
+public:
+    response_counter()
+        : size(0)
+    {
+    }
+    inline void append(string_view_t text)
+    {
+        size += text.size();
+    }
+    inline void append(char_t c)
+    {
+        size += 1;
+    }
+public:
+    size_t size;
+};
 
-    ostringstream_t res;
+// 𐔂obt@ɒڏ
+class response_writer
+{
+public:
+    explicit response_writer(char_t *dst)
+        : p(dst)
+    {
+    }
+    inline void append(string_view_t text)
+    {
+        p = std::copy(text.begin(), text.end(), p);
+    }
+    inline void append(char_t c)
+    {
+        *p++ = c;
+    }
+public:
+    char_t *p;
+};
 
-    res << SAORI_VERSIONSTRING _T(" ") << result_code << _T(" ") << rc_str << _T("\r\n");
+// 
+template<class Writer>
+static void append_number(Writer &writer, int value)
+{
+    char buffer[16];
 
-    res << _T("Charset: ") << saori::from_charset(charset) << _T("\r\n");
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
 
-    if (!result.empty())
+    for (const char *p = buffer; p != result.ptr; ++p)
     {
-        res << _T("Result: ") << result << _T("\r\n");
+        writer.append(static_cast<char_t>(*p));
     }
+}
+
+// s܂ޒĺAs \1 ɒuď
+template<class Writer>
+static void append_value(Writer &writer, string_view_t value)
+{
+    string_view_t::size_type begin = 0;
+    string_view_t::size_type pos;
 
-    if (!values.empty())
+    while ((pos = value.find_first_of(_T("\r\n"), begin)) != string_view_t::npos)
     {
-        for (std::vector<string_t>::size_type i = 0; i < values.size(); ++i)
-        {
-            res << _T("Value") << i << _T(": ");
+        writer.append(value.substr(begin, pos - begin));
+        writer.append(_T('\1'));
 
-            string_t value = values[i];
-            string_t::size_type pos = 0;
+        // CR LF ͂܂Ƃ߂ 1 ɂ
+        begin = pos + (value.compare(pos, 2, _T("\r\n")) == 0 ? 2 : 1);
+    }
 
-            while ((pos = value.find_first_of(_T("\r\n"), pos)) != string_t::npos)
-            {
-                value.replace(pos, 2, _T("\1"));
-            }
+    writer.append(value.substr(begin));
+}
 
-            res << value << _T("\r\n");
-        }
+template<class Writer>
+void saori_output::write(Writer &writer) const
+{
+    writer.append(SAORI_VERSIONSTRING _T(" "));
+    append_number(writer, result_code);
+    writer.append(_T(' '));
+    writer.append(saori::from_result(result_code));
+    writer.append(_T("\r\n"));
+
+    writer.append(_T("Charset: "));
+    writer.append(saori::from_charset(charset));
+    writer.append(_T("\r\n"));
+
+    if (!result.empty())
+    {
+        writer.append(_T("Result: "));
+        writer.append(result);
+        writer.append(_T("\r\n"));
     }
 
-    if (!opts.empty())
+    for (std::vector<string_t>::size_type i = 0; i < values.size(); ++i)
     {
-        for (std::map<string_t, string_t>::const_iterator it = opts.begin(); it != opts.end(); ++it)
-        {
-            res << it->first << _T(": ") << it->second << _T("\r\n");
-        }
+        writer.append(_T("Value"));
+        append_number(writer, static_cast<int>(i));
+        writer.append(_T(": "));
+        append_value(writer, values[i]);
+        writer.append(_T("\r\n"));
     }
 
-    res << _T("\r\n");
+    for (auto it = opts.cbegin(); it != opts.cend(); ++it)
+    {
+        writer.append(it->first);
+        writer.append(_T(": "));
+        writer.append(it->second);
+        writer.append(_T("\r\n"));
+    }
 
-    return res.str();
+    writer.append(_T("\r\n"));
 }
 
-std::string saori::request(std::string req)
+size_t saori_output::serialized_size() const
 {
-    SAORICharset charset = SAORICHARSET_SHIFT_JIS;
+    response_counter counter;
+    write(counter);
+    return counter.size;
+}
 
-#ifdef _SAORI_UNICODE
-    std::string temp = req;
-    std::transform(temp.begin(), temp.end(), temp.begin(), tolower);
+char_t *saori_output::serialize(char_t *dst) const
+{
+    response_writer writer(dst);
+    write(writer);
+    return writer.p;
+}
 
-    std::string::size_type char_pos = temp.find("\ncharset: ");
+// enter  leave ΂ɂČĂ
+class execution_scope
+{
+public:
+    execution_scope(saori &instance, const saori_input &in)
+        : _instance(instance)
+    {
+        _instance.enter(in);
+    }
+    ~execution_scope()
+    {
+        _instance.leave();
+    }
+private:
+    execution_scope(const execution_scope &);
+    execution_scope &operator=(const execution_scope &);
+private:
+    saori &_instance;
+};
+
+void *saori::request(std::string_view req, long *len)
+{
+    SAORICharset charset = SAORICHARSET_SHIFT_JIS;
 
-    if (char_pos != std::string::npos)
+#ifdef _SAORI_UNICODE
+    // ϊÕNGXg Charset wb_T
+    for (std::string_view::size_type begin = req.find('\n'); begin != std::string_view::npos; begin = req.find('\n', begin))
     {
-        char_pos += 10;
-        charset = to_charset(temp.substr(char_pos, temp.find("\r\n", char_pos) - char_pos));
+        begin += 1;
+
+        if (req.size() - begin >= 9 && equals_ignore_case(req.substr(begin, 9), "charset: "))
+        {
+            std::string_view::size_type value_pos = begin + 9;
+            charset = to_charset(req.substr(value_pos, req.find("\r\n", value_pos) - value_pos));
+            break;
+        }
     }
 
     string_t req_t = to_unicode(charset, req);
 #else
-    string_t req_t = req;
+    string_view_t req_t = req;
 #endif /* _SAORI_UNICODE */
 
     saori_input in(req_t);
     in.charset = charset;
-    in.opts[_T("SecurityLevel")] = _T("Local");
 
     saori_output out;
     out.charset = in.charset;
     out.result_code = SAORIRESULT_BAD_REQUEST;
 
-    if (in.command == _T("GET Version"))
+    if (in.command == _T("EXECUTE") && (in.function == _T("async") || in.function == _T("wait") || in.function == _T("poll") || in.function == _T("cancel")))
+    {
+        out.result_code = execute_job(in, out);
+    }
+    else
+    {
+        if (in.command == _T("GET Version"))
+        {
+            out.result_code = SAORIRESULT_OK;
+        }
+        else if (in.command == _T("EXECUTE"))
+        {
+            out.result_code = in.function == _T("batch") ? execute_batch(in, out) : execute(in, out);
+        }
+
+        // ㏈s
+        idle();
+    }
+
+    // 𐔂Ămۂobt@ 1 xŏ
+    size_t size = out.serialized_size();
+
+#ifdef _SAORI_UNICODE
+    string_t res_t(size, _T('\0'));
+    out.serialize(&res_t[0]);
+
+#ifdef _WINDOWS
+    // ϊ̒ŊmۂĒڕϊ
+    int length = WideCharToMultiByte(out.charset, 0, res_t.data(), static_cast<int>(res_t.size()), NULL, 0, NULL, NULL);
+
+    char *res = static_cast<char *>(SAORI_ALLOC(length + 1));
+    if (res)
+    {
+        WideCharToMultiByte(out.charset, 0, res_t.data(), static_cast<int>(res_t.size()), res, length, NULL, NULL);
+        res[length] = '\0';
+    }
+#else
+    std::string converted = from_unicode(out.charset, res_t);
+    size_t length = converted.size();
+
+    char *res = static_cast<char *>(SAORI_ALLOC(length + 1));
+    if (res)
+    {
+        memcpy(res, converted.c_str(), length + 1);
+    }
+#endif /* _WINDOWS */
+
+    *len = static_cast<long>(length);
+#else
+    char *res = static_cast<char *>(SAORI_ALLOC(size + 1));
+    if (res)
     {
-        out.result_code = SAORIRESULT_OK;
+        *out.serialize(res) = '\0';
     }
-    else if (in.command == _T("EXECUTE"))
+
+    *len = static_cast<long>(size);
+#endif /* _SAORI_UNICODE */
+
+    return res;
+}
+
+SAORIResult saori::execute(const saori_input &in, saori_output &out)
+{
+    saori_function function = find_function != NULL ? find_function(in.function) : NULL;
+    if (function == NULL)
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    try
+    {
+        // gĂяoʂ̃XbhŎs̏ꍇ͏I܂ő҂
+        // ob`̓R}hɌĂ΂̂ŁAÕR}ȟʂ󂯎ΏۂɂȂ
+        execution_scope scope(*this, in);
+
+        return function(in, out);
+    }
+    catch (...)
+    {
+        return SAORIRESULT_INTERNAL_SERVER_ERROR;
+    }
+}
+
+SAORIResult saori::execute_batch(const saori_input &in, saori_output &out)
+{
+    // ʂ͒uQƂ̂ŁAR}h̍ő吔ɊmۂĈړȂ悤ɂ
+    out.values.reserve(in.args.size() / 2 + 1);
+
+    saori_input command;
+    command.charset = in.charset;
+
+    // R}h̒ǉAʂ̌ɂ܂Ƃ߂Ēǉ
+    std::vector<std::vector<string_t>> command_values;
+
+    // ~߂R}ȟʁASĐꍇ 200
+    SAORIResult stopped = SAORIRESULT_OK;
+
+    for (std::vector<string_view_t>::size_type begin = 0; begin < in.args.size();)
     {
-        std::map<string_t, saori_function>::const_iterator it = functions.lower_bound(in.function);
-        if (it != functions.end())
+        std::vector<string_view_t>::size_type end = std::find(in.args.begin() + begin, in.args.end(), batch_separator) - in.args.begin();
+
+        // ̃R}h͔΂
+        if (end == begin)
         {
+            begin = end + 1;
+            continue;
+        }
+
+        command.function = in.args[begin];
+        command.args.clear();
+
+        bool valid = true;
+
+        for (std::vector<string_view_t>::size_type i = begin + 1; i < end && valid; ++i)
+        {
+            string_view_t arg = in.args[i];
+
+            if (arg.size() >= 2 && arg[0] == _T('$'))
+            {
+                if (arg[1] == _T('$'))
+                {
+                    // "$$"  "$" n܂̂
+                    arg.remove_prefix(1);
+                }
+                else
+                {
+                    // "$N"  N Ԗڂ̃R}ȟʂɒu
+                    std::vector<string_t>::size_type index = 0;
+
+                    for (string_view_t::size_type j = 1; j < arg.size() && valid; ++j)
+                    {
+                        valid = arg[j] >= _T('0') && arg[j] <= _T('9') && index <= out.values.size();
+                        index = index * 10 + (arg[j] - _T('0'));
+                    }
+
+                    valid = valid && index >= 1 && index <= out.values.size();
+
+                    if (valid)
+                    {
+                        arg = out.values[index - 1];
+                    }
+                }
+            }
+
+            command.args.push_back(arg);
+        }
+
+        saori_output result;
+        result.charset = in.charset;
+
+        SAORIResult code = valid ? execute(command, result) : SAORIRESULT_BAD_REQUEST;
+
+        // sR}hŎ~߂
+        if (code != SAORIRESULT_OK && code != SAORIRESULT_NO_CONTENT)
+        {
+            stopped = code;
+            break;
+        }
+
+        out.values.push_back(std::move(result.result));
+        command_values.push_back(std::move(result.values));
+
+        begin = end + 1;
+    }
+
+    // R}h̐ԂASĐĂ΃R}h̐ƓɂȂ
+    out.result = conv<string_t>(out.values.size());
+
+    // ʂ̌ɁA~߂R}ȟʂƁAR}h̒ǉ̐ƒǉ𑱂
+    out.values.push_back(conv<string_t>(static_cast<int>(stopped)));
+
+    for (auto it = command_values.begin(); it != command_values.end(); ++it)
+    {
+        out.values.push_back(conv<string_t>(it->size()));
+        out.values.insert(out.values.end(), std::make_move_iterator(it->begin()), std::make_move_iterator(it->end()));
+    }
+
+    return SAORIRESULT_OK;
+}
+
+SAORIResult saori::execute_job(const saori_input &in, saori_output &out)
+{
+    VERIFY_ARGUMENT(1);
+
+    if (in.function == _T("async"))
+    {
+        // Ăяo֐ƈ̓NGXgꂽĝŕĂ
+        std::shared_ptr<saori_job> job = std::make_shared<saori_job>();
+
+        job->state = saori_job::job_queued;
+        job->charset = in.charset;
+        job->function.assign(in.args[0]);
+        job->args.assign(in.args.begin() + 1, in.args.end());
+        job->result_code = SAORIRESULT_BAD_REQUEST;
+
+        int id;
+
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+
+            id = ++last_job_id;
+            jobs[id] = job;
+        }
+
+        // [J[͏ɍ쐬Ďg
+        if (!job_workers)
+        {
+            job_workers.reset(new worker_pool(1));
+        }
+
+        job_workers->post([this, job](int) { run_job(job); });
+
+        // Wu ID Ԃ
+        out.result = conv<string_t>(id);
+
+        return SAORIRESULT_OK;
+    }
+
+    int id;
+
+    try
+    {
+        id = conv<int>(in.args[0]);
+    }
+    catch (...)
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+
+    auto it = jobs.find(id);
+    if (it == jobs.end())
+    {
+        return SAORIRESULT_BAD_REQUEST;
+    }
+
+    std::shared_ptr<saori_job> job = it->second;
+
+    if (in.function == _T("cancel"))
+    {
+        // šĂяo͎~߂ȂAIĂяo͌ʂ̂Ă
+        if (job->state == saori_job::job_running)
+        {
+            return SAORIRESULT_BAD_REQUEST;
+        }
+
+        job->state = saori_job::job_cancelled;
+        jobs.erase(it);
+
+        return SAORIRESULT_OK;
+    }
+
+    if (in.function == _T("wait"))
+    {
+        VERIFY_ARGUMENT_RANGE(1, 2);
+
+        auto finished = [&job] { return job->state == saori_job::job_finished; };
+
+        // ^CAEg (~b) ꍇ͏I܂ő҂
+        if (CHECK_ARGUMENT(2))
+        {
+            int timeout;
+
             try
             {
-                out.result_code = it->second(in, out);
+                timeout = conv<int>(in.args[1]);
             }
             catch (...)
             {
-                out.result_code = SAORIRESULT_INTERNAL_SERVER_ERROR;
+                return SAORIRESULT_BAD_REQUEST;
             }
+
+            job_finished.wait_for(lock, std::chrono::milliseconds(timeout), finished);
+        }
+        else
+        {
+            job_finished.wait(lock, finished);
         }
     }
 
-    string_t res_t = out.serialize();
+    // IĂȂꍇ 204 Ԃ
+    if (job->state != saori_job::job_finished)
+    {
+        return SAORIRESULT_NO_CONTENT;
+    }
 
-#ifdef _SAORI_UNICODE
-    std::string res = from_unicode(out.charset, res_t);
-#else
-    std::string res = res_t;
-#endif /* _SAORI_UNICODE */
+    // ʂ 1 xԂA݂Ȃ ID  400 Ƌʂł悤 200 Ԃ
+    // Result ɌĂяõXe[^XR[hAValue0 ɌʁAValue1 ȍ~ɒl
+    jobs.erase(id);
 
-    return res;
+    out.result = conv<string_t>(static_cast<int>(job->result_code));
+    out.values.push_back(std::move(job->result));
+    out.values.insert(out.values.end(), std::make_move_iterator(job->values.begin()), std::make_move_iterator(job->values.end()));
+
+    return SAORIRESULT_OK;
+}
+
+void saori::run_job(const std::shared_ptr<saori_job> &job)
+{
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+
+        // ꂽĂяo͎sȂ
+        if (job->state != saori_job::job_queued)
+        {
+            return;
+        }
+
+        job->state = saori_job::job_running;
+    }
+
+    saori_input in;
+    in.charset = job->charset;
+    in.function = job->function;
+    in.args.assign(job->args.begin(), job->args.end());
+
+    saori_output out;
+    out.charset = job->charset;
+
+    SAORIResult result_code = in.function == _T("batch") ? execute_batch(in, out) : execute(in, out);
+
+    idle();
+
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+
+        job->result_code = result_code;
+        job->result = std::move(out.result);
+        job->values = std::move(out.values);
+        job->state = saori_job::job_finished;
+
+        reap_jobs();
+    }
+
+    job_finished.notify_all();
+}
+
+void saori::reap_jobs()
+{
+    size_t finished = 0;
+
+    for (auto it = jobs.begin(); it != jobs.end(); ++it)
+    {
+        if (it->second->state == saori_job::job_finished)
+        {
+            finished += 1;
+        }
+    }
+
+    // ID ̏AÂĂяo猋ʂ̂Ă
+    for (auto it = jobs.begin(); it != jobs.end() && finished > max_finished_jobs;)
+    {
+        if (it->second->state == saori_job::job_finished)
+        {
+            it = jobs.erase(it);
+            finished -= 1;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void saori::stop_jobs()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+
+        for (auto it = jobs.begin(); it != jobs.end(); ++it)
+        {
+            if (it->second->state == saori_job::job_queued)
+            {
+                it->second->state = saori_job::job_cancelled;
+            }
+        }
+
+        jobs.clear();
+    }
+
+    // c^XN͎Ă̂ŁAšĂяo҂ƂɂȂ
+    job_workers.reset();
+}
+
+saori::~saori()
+{
+    stop_jobs();
 }
 
 string_t saori::from_result(SAORIResult result)
@@ -202,21 +714,21 @@ string_t saori::from_charset(SAORICharset charset)
     return _T("unknown charset");
 }
 
-SAORICharset saori::to_charset(const std::string &str)
+SAORICharset saori::to_charset(std::string_view str)
 {
-    if (str == "shift_jis" || str == "x-sjis")
+    if (equals_ignore_case(str, "shift_jis") || equals_ignore_case(str, "x-sjis"))
     {
         return SAORICHARSET_SHIFT_JIS;
     }
-    else if (str == "iso-2022-jp")
+    else if (equals_ignore_case(str, "iso-2022-jp"))
     {
         return SAORICHARSET_ISO_2022_JP;
     }
-    else if (str == "euc-jp" || str == "x-euc-jp")
+    else if (equals_ignore_case(str, "euc-jp") || equals_ignore_case(str, "x-euc-jp"))
     {
         return SAORICHARSET_EUC_JP;
     }
-    else if (str == "utf-8")
+    else if (equals_ignore_case(str, "utf-8"))
     {
         return SAORICHARSET_UTF_8;
     }
@@ -225,26 +737,34 @@ SAORICharset saori::to_charset(const std::string &str)
 
 #ifdef _SAORI_UNICODE
 
-std::wstring saori::to_unicode(SAORICharset charset, const std::string &str)
+std::wstring saori::to_unicode(SAORICharset charset, std::string_view str)
 {
 #ifdef _WINDOWS
-    int length = MultiByteToWideChar(charset, 0, str.c_str(), -1, NULL, 0);
-    std::vector<wchar_t> wstr(length + 1);
-    length = MultiByteToWideChar(charset, 0, str.c_str(), -1, &wstr[0], length + 1);
-    return std::wstring(wstr.begin(), wstr.begin() + length);
+    int length = MultiByteToWideChar(charset, 0, str.data(), static_cast<int>(str.size()), NULL, 0);
+    if (length <= 0)
+    {
+        return std::wstring();
+    }
+    std::wstring wstr(length, L'\0');
+    MultiByteToWideChar(charset, 0, str.data(), static_cast<int>(str.size()), &wstr[0], length);
+    return wstr;
 #else
     // not implemented
     return std::wstring();
 #endif /* _WINDOWS */
 }
 
-std::string saori::from_unicode(SAORICharset charset, const std::wstring &wstr)
+std::string saori::from_unicode(SAORICharset charset, std::wstring_view wstr)
 {
 #ifdef _WINDOWS
-    int length = WideCharToMultiByte(charset, 0, wstr.c_str(), -1, NULL, 0, NULL, NULL);
-    std::vector<char> str(length + 1);
-    length = WideCharToMultiByte(charset, 0, wstr.c_str(), -1, &str[0], length + 1, NULL, NULL);
-    return std::string(str.begin(), str.begin() + length);
+    int length = WideCharToMultiByte(charset, 0, wstr.data(), static_cast<int>(wstr.size()), NULL, 0, NULL, NULL);
+    if (length <= 0)
+    {
+        return std::string();
+    }
+    std::string str(length, '\0');
+    WideCharToMultiByte(charset, 0, wstr.data(), static_cast<int>(wstr.size()), &str[0], length, NULL, NULL);
+    return str;
 #else
     // not implemented
     return std::string();
@@ -297,7 +817,9 @@ SAORIAPI int SAORICALL unload()
         return 0;
     }
 
-    // A[h
+    // 񓯊̌Ăяo~߂ĂA[h
+    instance->stop_jobs();
+
     int ret = instance->unload();
 
     // CX^XJ
@@ -309,15 +831,10 @@ SAORIAPI int SAORICALL unload()
 
 SAORIAPI void * SAORICALL request(void *h, long *len)
 {
-    std::string res = instance->request(std::string(reinterpret_cast<char *>(h), *len));
+    // NGXg̃obt@͏I܂ŉȂ
+    void *res = instance->request(std::string_view(reinterpret_cast<char *>(h), *len), len);
 
     SAORI_FREE(h);
 
-    *len = static_cast<long>(res.size());
-    h = SAORI_ALLOC(*len + 1);
-    if (h)
-    {
-        memcpy(h, res.c_str(), *len + 1);
-    }
-    return h;
+    return res;
 }
\ No newline at end of file
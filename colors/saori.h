@@ -5,7 +5,11 @@
 
 #pragma once
 
+#include <cstdio>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <stdexcept>
 #include <vector>
 #include <map>
 #include <locale>
@@ -14,13 +18,19 @@
 #include <type_traits>
 #include <functional>
 #include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <condition_variable>
 
 #include <boost/lexical_cast.hpp>
 
+#include "parallel.hpp"
+
 // vbgtH[
 #ifdef _WINDOWS
 
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 #include <windows.h>
 
 #ifdef _DEBUG
@@ -40,7 +50,7 @@
 
 #else
 
-#define SAORIAPI extern "C"
+#define SAORIAPI extern "C" __attribute__((visibility("default")))
 #define SAORICALL
 
 // AP[^̒ۉ
@@ -63,6 +73,8 @@ typedef wchar_t char_t;
 
 #define tfopen_s _wfopen_s
 
+#define tremove _wremove
+
 #endif /* _MSC_VER */
 
 #else
@@ -71,8 +83,23 @@ typedef wchar_t char_t;
 
 typedef char char_t;
 
+#define tremove remove
+
+#ifdef _MSC_VER
+
 #define tfopen_s fopen_s
 
+#else
+
+// fopen_s ł fopen őp
+inline int tfopen_s(FILE **fp, const char *file, const char *mode)
+{
+    *fp = fopen(file, mode);
+    return *fp != NULL ? 0 : 1;
+}
+
+#endif /* _MSC_VER */
+
 #endif /* _SAORI_UNICODE */
 
 // SAORI o[W
@@ -81,7 +108,13 @@ typedef char char_t;
 
 // SAORI wp[}N
 #define DEFINE_SAORI_FUNCTION(name) SAORIResult saori_function_##name(const saori_input &in, saori_output &out)
-#define REGISTER_SAORI_FUNCTION(name) functions[_T(#name)] = saori_function_##name
+#define REGISTER_SAORI_FUNCTION(name) { _T(#name), saori_function_##name },
+
+// REGISTER_SAORI_FUNCTION ׂꗗARpCɊ֐\쐬
+#define REGISTER_SAORI_FUNCTIONS(list) \
+    static constexpr saori_function_entry saori_function_entries[] = { list(REGISTER_SAORI_FUNCTION) }; \
+    static constexpr saori_function_table<sizeof(saori_function_entries) / sizeof(saori_function_entries[0])> saori_functions(saori_function_entries); \
+    find_function = [](string_view_t name) { return saori_functions.find(name); }
 
 #define VERIFY_ARGUMENT(min) if (in.args.size() < min) { return SAORIRESULT_BAD_REQUEST; }
 #define VERIFY_ARGUMENT_RANGE(min, max) if (in.args.size() < min || in.args.size() > max) { return SAORIRESULT_BAD_REQUEST; }
@@ -93,6 +126,7 @@ SAORIAPI int SAORICALL unload();
 SAORIAPI void * SAORICALL request(void *h, long *len);
 
 typedef std::basic_string<char_t> string_t;
+typedef std::basic_string_view<char_t> string_view_t;
 typedef std::basic_istringstream<char_t> istringstream_t;
 typedef std::basic_ostringstream<char_t> ostringstream_t;
 
@@ -116,27 +150,128 @@ class saori_input;
 class saori_output;
 
 // SAORI ֐
-typedef std::function<SAORIResult(const saori_input &, saori_output &)> saori_function;
+typedef SAORIResult (*saori_function)(const saori_input &, saori_output &);
+
+struct saori_function_entry
+{
+    const char_t *name;
+    saori_function function;
+};
+
+// ֐֐ASnbVgꗗ
+// SĂ̖OՓ˂ȂnbV̎RpCɒT̂ŁA 1 ̔rōς
+template<size_t Count>
+class saori_function_table
+{
+public:
+    constexpr saori_function_table(const saori_function_entry (&entries)[Count])
+        : _seed(0), _entries(), _slots()
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            _entries[i] = entries[i];
+        }
+
+        // Փ˂Ȃ킪Ȃꍇ́A萔ɂȂ炸ɃRpCG[ɂȂ
+        while (!try_seed())
+        {
+            if (++_seed > max_seed)
+            {
+                throw std::logic_error("saori_function_table");
+            }
+        }
+    }
+    // OSɈv֐ԂAȂꍇ NULL Ԃ
+    saori_function find(string_view_t name) const
+    {
+        int index = _slots[hash(name, _seed) & slot_mask];
+
+        if (index < 0 || name != _entries[index].name)
+        {
+            return NULL;
+        }
+        return _entries[index].function;
+    }
+private:
+    static constexpr unsigned int max_seed = 65536;
+
+    // ֐̐ 2 {ȏ 2 ̗ݏɂ
+    static constexpr size_t slot_count()
+    {
+        size_t count = 1;
+        while (count < Count * 2)
+        {
+            count *= 2;
+        }
+        return count;
+    }
+
+    static constexpr size_t slot_mask = slot_count() - 1;
+
+    // FNV-1a Ɏ
+    static constexpr unsigned int hash(string_view_t name, unsigned int seed)
+    {
+        unsigned int value = 2166136261u ^ (seed * 16777619u);
+        for (size_t i = 0; i < name.size(); ++i)
+        {
+            value = (value ^ static_cast<unsigned int>(name[i])) * 16777619u;
+        }
+        return value ^ (value >> 16);
+    }
+
+    constexpr bool try_seed()
+    {
+        for (size_t i = 0; i < slot_count(); ++i)
+        {
+            _slots[i] = -1;
+        }
+
+        for (size_t i = 0; i < Count; ++i)
+        {
+            int &slot = _slots[hash(_entries[i].name, _seed) & slot_mask];
+
+            if (slot >= 0)
+            {
+                return false;
+            }
+
+            slot = static_cast<int>(i);
+        }
+        return true;
+    }
+private:
+    unsigned int _seed;
+    saori_function_entry _entries[Count];
+    int _slots[slot_count()];
+};
 
 // SAORI NGXg
+// eڂ̓NGXg̕𒼐ڎQƂ̂ŁA񂪗LȊԂg
 class saori_input
 {
 public:
-    saori_input(string_t req) { deserialize(req); }
-    bool deserialize(string_t req);
+    saori_input() : charset(SAORICHARSET_SHIFT_JIS) {}
+    saori_input(string_view_t req) { deserialize(req); }
+    bool deserialize(string_view_t req);
 public:
     SAORICharset charset;
-    string_t command;
-    string_t function;
-    std::vector<string_t> args;
-    std::map<string_t, string_t> opts;
+    string_view_t command;
+    string_view_t function;
+    std::vector<string_view_t> args;
+    std::vector<std::pair<string_view_t, string_view_t>> opts;
 };
 
 // SAORI X|X
 class saori_output
 {
 public:
-    string_t serialize();
+    // X|X̕
+    size_t serialized_size() const;
+    // serialized_size() ȏ̒̃obt@ɏ݁A񂾖Ԃ
+    char_t *serialize(char_t *dst) const;
+private:
+    template<class Writer>
+    void write(Writer &writer) const;
 public:
     SAORICharset charset;
     SAORIResult result_code;
@@ -145,11 +280,33 @@ public:
     std::map<string_t, string_t> opts;
 };
 
+// 񓯊Ɏs֐Ăяo
+struct saori_job
+{
+    enum state_type
+    {
+        job_queued,
+        job_running,
+        job_finished,
+        job_cancelled
+    };
+
+    state_type state;
+    SAORICharset charset;
+    string_t function;
+    std::vector<string_t> args;
+    // IĂяǒ
+    SAORIResult result_code;
+    string_t result;
+    std::vector<string_t> values;
+};
+
 // SAORI C
 class saori
 {
 public:
     saori(const std::string &path)
+        : find_function(NULL), last_job_id(0)
     {
 #ifdef _SAORI_UNICODE
         setlocale(LC_ALL, "Japanese");
@@ -158,33 +315,155 @@ public:
         saori_path = path;
 #endif /* _SAORI_UNICODE */
     }
+    ~saori();
     // ׂ֐
     bool load();
     bool unload();
-    // NGXg֐
-    std::string request(std::string req);
+    // NGXg̏IxɌĂ΂
+    void idle();
+    // ֐ĂяoOƌɌĂ΂AĂяogmۂĎ
+    // 񓯊̌ĂяoƓɌĂ΂邱Ƃ̂ŁAgĂяo҂
+    void enter(const saori_input &in);
+    void leave();
+    // NGXg֐AX|X SAORI_ALLOC ŊmۂĕԂ
+    void *request(std::string_view req, long *len);
+    // ҂Ă񓯊̌ĂяoAšĂяoI܂ő҂
+    void stop_jobs();
+private:
+    // ֐ĂяoAO 500 ƂĕԂ
+    SAORIResult execute(const saori_input &in, saori_output &out);
+    //  ";" ŋ؂̃R}hƂďɎs
+    // "$N" ̈ N Ԗڂ̃R}ȟʂɒuAsR}hŏ~߂
+    // Result ͐R}h̐ nAValue0  Value(n-1) ͊eR}ȟ
+    // Value(n) ͏~߂R}ȟ (400  500 Ȃ)ASĐꍇ 200
+    // ̌ɐR}hɁAǉ̐ k  k ̒ǉ񂪑
+    SAORIResult execute_batch(const saori_input &in, saori_output &out);
+    // async, wait, poll, cancel AšĂяo҂ɏł
+    SAORIResult execute_job(const saori_input &in, saori_output &out);
+    // [J[Ŕ񓯊̌Ăяos
+    void run_job(const std::shared_ptr<saori_job> &job);
+    // 󂯎Ȃ܂܏IĂяoꍇɌÂ̂̂ĂAjobs_mutex 擾ԂŌĂԂ
+    void reap_jobs();
+    // ʂێĂIĂяo̐
+    static const size_t max_finished_jobs = 64;
 private:
     string_t saori_path;
-    std::map<string_t, saori_function> functions;
+    // load  REGISTER_SAORI_FUNCTIONS ɂĐݒ肷
+    saori_function (*find_function)(string_view_t name);
+    // 񓯊̌Ăяos郏[J[ƁAID ̌Ăяo
+    std::unique_ptr<worker_pool> job_workers;
+    std::map<int, std::shared_ptr<saori_job>> jobs;
+    int last_job_id;
+    std::mutex jobs_mutex;
+    std::condition_variable job_finished;
 public:
     static string_t from_result(SAORIResult result);
     static string_t from_charset(SAORICharset charset);
-    static SAORICharset to_charset(const std::string &str);
+    static SAORICharset to_charset(std::string_view str);
 #ifdef _SAORI_UNICODE
-    static std::wstring to_unicode(SAORICharset charset, const std::string &str);
-    static std::string from_unicode(SAORICharset charset, const std::wstring &wstr);
+    static std::wstring to_unicode(SAORICharset charset, std::string_view str);
+    static std::string from_unicode(SAORICharset charset, std::wstring_view wstr);
 #endif /* _SAORI_UNICODE */
 };
 
 // ^ϊ + R[hϊwp[
 namespace conv_helper
 {
+    // 𐔒lɕϊAŜlƂēǂ߂Ȃꍇ͗O𓊂
+    template<class Number>
+    Number parse_number(string_view_t text)
+    {
+        // from_chars  char ɂΉȂ̂ŁAlɎg ASCII ͈̔͂lߒ
+        char buffer[64];
+
+        if (text.size() >= sizeof(buffer))
+        {
+            throw std::invalid_argument("conv");
+        }
+
+        size_t length = 0;
+
+        for (auto it = text.begin(); it != text.end(); ++it)
+        {
+            if (static_cast<unsigned long>(*it) > 0x7f)
+            {
+                throw std::invalid_argument("conv");
+            }
+            buffer[length++] = static_cast<char>(*it);
+        }
+
+        const char *first = buffer;
+        const char *last = buffer + length;
+
+        // lexical_cast Ɠ擪 + 
+        if (first != last && *first == '+')
+        {
+            ++first;
+        }
+
+        // lexical_cast ƓȂ̌^ł̐󂯕t
+        // XNvg ARGB ̐Ft 32bit Ƃēn邱Ƃ
+        if constexpr (std::is_integral<Number>::value && std::is_unsigned<Number>::value && !std::is_same<Number, bool>::value)
+        {
+            if (first != last && *first == '-')
+            {
+                typename std::make_signed<Number>::type signed_value;
+
+                std::from_chars_result result = std::from_chars(first, last, signed_value);
+
+                if (result.ec != std::errc() || result.ptr != last)
+                {
+                    throw std::invalid_argument("conv");
+                }
+
+                return static_cast<Number>(signed_value);
+            }
+        }
+
+        Number value;
+
+        std::from_chars_result result = std::from_chars(first, last, value);
+
+        if (result.ec != std::errc() || result.ptr != last)
+        {
+            throw std::invalid_argument("conv");
+        }
+
+        return value;
+    }
+
+    //  std::to_chars ŕɂ
+    template<class Number>
+    string_t format_number(Number value)
+    {
+        char buffer[32];
+
+        std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+
+        return string_t(buffer, result.ptr);
+    }
+
     template<class Target, class Source, bool IsConvertible>
     struct conv_op
     {
         Target operator()(const Source &src) const
         {
-            return boost::lexical_cast<Target>(src);
+            if constexpr (std::is_arithmetic<Target>::value && !std::is_same<Target, bool>::value && std::is_convertible<const Source &, string_view_t>::value)
+            {
+                return parse_number<Target>(src);
+            }
+            else if constexpr (std::is_same<Target, string_t>::value && std::is_convertible<const Source &, string_view_t>::value)
+            {
+                return string_t(string_view_t(src));
+            }
+            else if constexpr (std::is_same<Target, string_t>::value && std::is_integral<Source>::value && !std::is_same<Source, bool>::value && !std::is_same<Source, char>::value && !std::is_same<Source, wchar_t>::value)
+            {
+                return format_number(src);
+            }
+            else
+            {
+                return boost::lexical_cast<Target>(src);
+            }
         }
     };
 
@@ -205,7 +484,7 @@ namespace conv_helper
         {
             try
             {
-                return static_cast<char>(boost::lexical_cast<int>(src));
+                return static_cast<char>(conv_op<int, Source, false>()(src));
             }
             catch (...)
             {
@@ -214,6 +493,7 @@ namespace conv_helper
         }
     };
 
+#ifdef _SAORI_UNICODE
     // R[h݂͓ꉻőΏ
     template<>
     struct conv_op<std::string, std::wstring, false>
@@ -232,6 +512,7 @@ namespace conv_helper
             return saori::to_unicode(SAORICHARSET_SHIFT_JIS, src);
         }
     };
+#endif /* _SAORI_UNICODE */
 }
 
 template<class Target, class Source>
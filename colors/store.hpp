@@ -0,0 +1,806 @@
+/*
+    store.hpp
+    COLORS Image Store Library
+*/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+#include "saori.h"
+#include "image.hpp"
+#include "tile.hpp"
+#include "mask.hpp"
+#include "palette.hpp"
+#include "compress.hpp"
+
+//  ID ɑt[̈ꗗ
+struct image_entry
+{
+    // t[ȊO̕ێ`
+    enum kind_flags
+    {
+        kind_tiles = 1,
+        kind_mask = 2,
+        kind_indexed = 4,
+        kind_any = kind_tiles | kind_mask | kind_indexed
+    };
+
+    image_entry()
+        : dirty(false), evicted(false), compressing(false), last_access(0), access_time(0), accounted(0)
+    {
+    }
+    // t[ȊǑ`ŕێĂꍇ͂̎ށAt[̏ꍇ 0
+    inline int kind() const
+    {
+        return (tiles ? kind_tiles : 0) | (mask ? kind_mask : 0) | (indexed ? kind_indexed : 0);
+    }
+    // gpĂ郁ʁAt@CɃ}bvt[Ƒ̉摜ƋLĂ镔摜͊܂܂Ȃ
+    size_t bytes() const
+    {
+        size_t total = tiles ? tiles->bytes() : 0;
+        if (mask)
+        {
+            total += mask->bytes();
+        }
+        if (indexed)
+        {
+            total += indexed->bytes();
+        }
+        for (auto it = compressed.cbegin(); it != compressed.cend(); ++it)
+        {
+            total += it->bytes();
+        }
+        for (auto it = frames.cbegin(); it != frames.cend(); ++it)
+        {
+            // `l̃LbV́At@CɃ}bvt[łɂ
+            total += it->planar_bytes();
+            if (it->mapped())
+            {
+                continue;
+            }
+            // ̉摜̃obt@QƂĂ镔摜́AQƐ̉摜ŌvコĂ
+            if (it->is_view() && it->shared())
+            {
+                continue;
+            }
+            total += static_cast<size_t>(it->stride()) * it->height() * sizeof(color);
+        }
+        return total;
+    }
+    // ǂoĂēǂݍ݂ł邩
+    inline bool reloadable() const
+    {
+        return !files.empty() && !dirty;
+    }
+    // kɂČĂ郁
+    size_t saved() const
+    {
+        size_t total = 0;
+        for (auto it = compressed.cbegin(); it != compressed.cend(); ++it)
+        {
+            total += it->raw_bytes() - it->bytes();
+        }
+        return total;
+    }
+    std::vector<image> frames;
+    // ^CPʂŕێĂ摜Aʏ̉摜̏ꍇ͋
+    std::shared_ptr<tiled_image> tiles;
+    // At@`l̃}XNA쐬͕ύXȂ̂ŕ ID ƋL
+    std::shared_ptr<const alpha_mask> mask;
+    // pbĝ܂ܕێĂ摜
+    std::shared_ptr<indexed_image> indexed;
+    // kt[AkĂԂ frames ͋ɂȂ
+    std::vector<compressed_image> compressed;
+    // ǂݍ݌̃t@CAt@CȊO쐬ꂽꍇ͋
+    std::vector<string_t> files;
+    // ǂݍ݌ɕύXĂ
+    bool dirty;
+    // ̂߂ɒǂoĂ
+    bool evicted;
+    // obNOEhňkĂ
+    bool compressing;
+    // ŌɃANZXꂽ
+    unsigned long long last_access;
+    // ŌɃANZXꂽ (~b)
+    unsigned long long access_time;
+    // gpʂɌvサĂ郁
+    size_t accounted;
+};
+
+// 摜t@Cǂݍފ֐ASẴt@C 1  ID ̃t[Ƃēǂݍ
+typedef bool (*image_loader)(const std::vector<string_t> &, image_entry &);
+
+// obNOEhňk摜
+// t[͉摜ƃobt@LȂ̂ŁAʂ̃Xbhǂݍ߂
+struct compress_job
+{
+    int id;
+    // 擾_̍ŌɃANZXꂽAȌɃANZXꂽꍇ͌ʂ̂Ă
+    unsigned long long last_access;
+    std::vector<image> frames;
+    std::vector<compressed_image> compressed;
+    bool succeeded;
+    // SẴt[kÃt[͎
+    // ꂽꍇ͎c̃t[kɎsɂ
+    void run(const std::atomic<bool> &cancelled)
+    {
+        compressed.resize(frames.size());
+
+        succeeded = true;
+
+        for (size_t i = 0; i < frames.size() && succeeded; ++i)
+        {
+            succeeded = !cancelled && compressed[i].compress(frames[i]);
+        }
+
+        frames.clear();
+    }
+};
+
+// t̃Xbgŉ摜ǗRei
+// ID ̉ʃrbgXbgԍAʃrbgɂȂ
+// IȌĂяoƔ񓯊̌ĂяoɎg悤ɁA擾摜͂̃Xbhgpɂ
+// gp̉摜 unpin ܂ő̃Xbh擾łAǂo∳k̑ΏۂɂȂȂ
+class image_store
+{
+public:
+    image_store()
+        : _count(0), _clock(0), _usage(0), _budget(0), _loader(NULL), _saved(0), _inflated(0), _inflate_time(0), _inflate_max(0)
+    {
+    }
+    // ID 摜擾ĎgpɂA ID ⑼̃Xbhgp̏ꍇ NULL Ԃ
+    image_entry *find(int id)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        slot *s = locate(id);
+
+        if (s == NULL || busy(*s))
+        {
+            return NULL;
+        }
+
+        s->owner = std::this_thread::get_id();
+
+        // ǂoĂꍇ̓t@Cǂݍݒ
+        if (s->entry.evicted && !reload(s->entry))
+        {
+            return NULL;
+        }
+
+        // kĂꍇ͓WJ
+        if (!s->entry.compressed.empty() && !inflate(s->entry))
+        {
+            return NULL;
+        }
+
+        touch(s->entry);
+
+        return &s->entry;
+    }
+    // 摜ǉ ID ԂAǉłȂꍇ 0 Ԃ
+    // ǉ摜͒ǉXbhgpɂȂ
+    int insert(image_entry &&entry)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        int index;
+
+        if (!_free.empty())
+        {
+            // ς݂̃Xbgėp
+            index = _free.back();
+            _free.pop_back();
+        }
+        else
+        {
+            if (static_cast<int>(_slots.size()) >= slot_mask)
+            {
+                return 0;
+            }
+
+            index = static_cast<int>(_slots.size());
+            _slots.push_back(slot());
+        }
+
+        slot &s = _slots[index];
+
+        s.alive = true;
+        s.owner = std::this_thread::get_id();
+        s.entry = std::move(entry);
+
+        touch(s.entry);
+
+        _count += 1;
+
+        update(s.entry);
+
+        return (s.generation << slot_bits) | (index + 1);
+    }
+    int insert(image &&img)
+    {
+        image_entry entry;
+        entry.frames.push_back(std::move(img));
+
+        return insert(std::move(entry));
+    }
+    // ID Lǂ𒲂ׂAǂoꂽ摜∳kꂽ摜̂܂܂ɂ
+    bool contains(int id)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return locate(id) != NULL;
+    }
+    // 摜SẴt[ƋɔjA ID ɂ͉eȂ
+    // ǂoꂽ摜ǂݍݒAkꂽ摜WJ͂Ȃ
+    bool erase(int id)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        slot *s = locate(id);
+
+        if (s == NULL || busy(*s))
+        {
+            return false;
+        }
+
+        release((id & slot_mask) - 1);
+
+        return true;
+    }
+    // SẲ摜jAsς݂ ID ͈Ȍ㖳ɂȂ
+    // ̃Xbhgp̉摜́AgI_Ŕj
+    void clear()
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        _free.clear();
+
+        // Xbgԍėp悤ɋtŐς
+        for (int i = static_cast<int>(_slots.size()) - 1; i >= 0; --i)
+        {
+            if (_slots[i].alive && busy(_slots[i]))
+            {
+                _slots[i].doomed = true;
+            }
+            else if (_slots[i].alive)
+            {
+                release(i);
+            }
+            else if (_slots[i].generation <= max_generation)
+            {
+                _free.push_back(i);
+            }
+        }
+    }
+    // ĂяoŎg摜܂Ƃ߂ĎgpɂÃXbhgp̏ꍇ͑SĎg悤ɂȂ܂ő҂
+    // gpĂȂԂő҂̂ŁAXbhm݂҂邱Ƃ͂Ȃ
+    void pin(const std::vector<int> &ids)
+    {
+        std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+        _unpinned.wait(lock, [this, &ids]
+        {
+            for (auto it = ids.cbegin(); it != ids.cend(); ++it)
+            {
+                slot *s = locate(*it);
+
+                if (s != NULL && busy(*s))
+                {
+                    return false;
+                }
+            }
+            return true;
+        });
+
+        for (auto it = ids.cbegin(); it != ids.cend(); ++it)
+        {
+            slot *s = locate(*it);
+
+            if (s != NULL)
+            {
+                s->owner = std::this_thread::get_id();
+            }
+        }
+    }
+    // ̃Xbhgp̉摜SĎ
+    void unpin()
+    {
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+            std::thread::id self = std::this_thread::get_id();
+
+            for (size_t i = 0; i < _slots.size(); ++i)
+            {
+                if (_slots[i].owner != self)
+                {
+                    continue;
+                }
+
+                _slots[i].owner = std::thread::id();
+
+                // gp clear ꂽ摜
+                if (_slots[i].alive && _slots[i].doomed)
+                {
+                    release(static_cast<int>(i));
+                }
+                // `l̃LbV̍쐬⏑݂ɂjŕωʂvサ
+                else if (_slots[i].alive && !_slots[i].entry.evicted)
+                {
+                    update(_slots[i].entry);
+                }
+            }
+        }
+
+        _unpinned.notify_all();
+    }
+    // 𒴂Ă΁Aēǂݍ݂ł摜Âɒǂo
+    // 擾ς݂̎QƂɂȂ̂ŁANGXg̏ɂ͌Ă΂ȂƁÃXbhgp̉摜͎c
+    int evict()
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        if (_budget == 0 || _usage <= _budget)
+        {
+            return 0;
+        }
+
+        // ǂo摜W߂
+        std::vector<slot *> candidates;
+
+        for (auto it = _slots.begin(); it != _slots.end(); ++it)
+        {
+            if (it->alive && !busy(*it) && !it->entry.evicted && it->entry.reloadable())
+            {
+                candidates.push_back(&*it);
+            }
+        }
+
+        // ŌɃANZXꂽÂɕׂ
+        std::sort(candidates.begin(), candidates.end(), [](const slot *a, const slot *b)
+        {
+            return a->entry.last_access < b->entry.last_access;
+        });
+
+        int count = 0;
+
+        for (auto it = candidates.begin(); it != candidates.end() && _usage > _budget; ++it)
+        {
+            image_entry &entry = (*it)->entry;
+
+            _usage -= entry.accounted;
+            _saved -= entry.saved();
+
+            entry.accounted = 0;
+            entry.indexed.reset();
+            entry.compressed.clear();
+            entry.frames.clear();
+            entry.frames.shrink_to_fit();
+            entry.evicted = true;
+
+            count += 1;
+        }
+
+        return count;
+    }
+    // 莞ԃANZXĂȂ摜Ak摜ƂĎ擾
+    // 擾摜͌ʂ𔽉f܂ŁAdĎ擾Ȃ
+    // cached ̓obt@ǂݍ݂̃LbVQƂĂ邩ԂALbV̎QƂ͎̂ŋLƂ݂͂ȂȂ
+    template<class Cached>
+    std::vector<compress_job> idle(unsigned long long timeout, Cached cached)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        std::vector<compress_job> jobs;
+
+        unsigned long long now = current_time();
+
+        for (size_t i = 0; i < _slots.size(); ++i)
+        {
+            image_entry &entry = _slots[i].entry;
+
+            if (!_slots[i].alive || busy(_slots[i]) || entry.evicted || entry.compressing || !entry.compressed.empty() || entry.kind() != 0 || entry.frames.empty() || now - entry.access_time < timeout)
+            {
+                continue;
+            }
+
+            // ̉摜ƋLĂobt@́AkĂȂ̂őΏۂɂȂ
+            bool compressible = true;
+
+            for (auto it = entry.frames.cbegin(); it != entry.frames.cend() && compressible; ++it)
+            {
+                long owners = it->shared_buffer().use_count() - (cached(*it) ? 1 : 0);
+
+                compressible = !it->mapped() && owners <= 1;
+            }
+
+            if (!compressible)
+            {
+                continue;
+            }
+
+            compress_job job;
+
+            job.id = (_slots[i].generation << slot_bits) | static_cast<int>(i + 1);
+            job.last_access = entry.last_access;
+            job.frames = entry.frames;
+            job.succeeded = false;
+
+            entry.compressing = true;
+
+            jobs.push_back(std::move(job));
+        }
+
+        return jobs;
+    }
+    // kʂ𔽉fAkĂԂɃANZXꂽ摜͂̂܂܎c
+    bool commit(compress_job &job)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        slot *s = locate(job.id);
+
+        if (s == NULL)
+        {
+            return false;
+        }
+
+        image_entry &entry = s->entry;
+
+        entry.compressing = false;
+
+        if (!job.succeeded || busy(*s) || entry.evicted || entry.last_access != job.last_access)
+        {
+            return false;
+        }
+
+        entry.compressed = std::move(job.compressed);
+        entry.frames.clear();
+        entry.frames.shrink_to_fit();
+
+        _saved += entry.saved();
+
+        update(entry);
+
+        return true;
+    }
+    // ^C̊mۂȂǂŕωʂvサ
+    void update(image_entry &entry)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        size_t bytes = entry.bytes();
+
+        _usage = _usage - entry.accounted + bytes;
+
+        entry.accounted = bytes;
+    }
+    inline int size() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return _count;
+    }
+    // 摜gpĂ郁
+    inline size_t usage() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return _usage;
+    }
+    // A0 ̏ꍇ͖
+    inline size_t budget() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return _budget;
+    }
+    inline void budget(size_t value)
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        _budget = value;
+    }
+    // ǂo摜ǂݍݒ֐
+    inline void loader(image_loader value)
+    {
+        _loader = value;
+    }
+    // kɂČĂ郁
+    inline size_t saved() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return _saved;
+    }
+    // k摜WJ
+    inline unsigned long long inflated() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return _inflated;
+    }
+    // WJɂvԂƍő厞 (}CNb)
+    inline unsigned long long inflate_time() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return _inflate_time;
+    }
+    inline unsigned long long inflate_max() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return _inflate_max;
+    }
+private:
+    // ID ̍\
+    static const int slot_bits = 20;
+    static const int slot_mask = (1 << slot_bits) - 1;
+    static const int max_generation = (1 << (31 - slot_bits)) - 1;
+
+    struct slot
+    {
+        slot()
+            : generation(0), alive(false), doomed(false)
+        {
+        }
+        int generation;
+        bool alive;
+        // gp̃XbhAgp clear ꂽꍇ͎_Ŕj
+        std::thread::id owner;
+        bool doomed;
+        image_entry entry;
+    };
+
+    // ID Xbg擾A ID ̏ꍇ NULL Ԃ
+    slot *locate(int id)
+    {
+        if (id <= 0)
+        {
+            return NULL;
+        }
+
+        // XbgԍƐɕ
+        int index = (id & slot_mask) - 1;
+        int generation = id >> slot_bits;
+
+        if (index < 0 || index >= static_cast<int>(_slots.size()))
+        {
+            return NULL;
+        }
+
+        slot &s = _slots[index];
+
+        // ς݁A͍ėpꂽXbg͖
+        if (!s.alive || s.generation != generation)
+        {
+            return NULL;
+        }
+
+        return &s;
+    }
+    // ̃XbhgpAbN擾ԂŌĂԂ
+    static bool busy(const slot &s)
+    {
+        return s.owner != std::thread::id() && s.owner != std::this_thread::get_id();
+    }
+    static unsigned long long current_time()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    void touch(image_entry &entry)
+    {
+        entry.last_access = ++_clock;
+        entry.access_time = current_time();
+    }
+    bool inflate(image_entry &entry)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<image> frames(entry.compressed.size());
+
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            if (!entry.compressed[i].decompress(frames[i]))
+            {
+                return false;
+            }
+        }
+
+        _saved -= entry.saved();
+
+        entry.frames = std::move(frames);
+        entry.compressed.clear();
+
+        update(entry);
+
+        unsigned long long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        _inflated += 1;
+        _inflate_time += elapsed;
+        _inflate_max = std::max(_inflate_max, elapsed);
+
+        return true;
+    }
+    bool reload(image_entry &entry)
+    {
+        if (_loader == NULL)
+        {
+            return false;
+        }
+
+        image_entry loaded;
+
+        if (!_loader(entry.files, loaded))
+        {
+            return false;
+        }
+
+        entry.frames = std::move(loaded.frames);
+        entry.indexed = std::move(loaded.indexed);
+        entry.evicted = false;
+
+        update(entry);
+
+        return true;
+    }
+    void release(int index)
+    {
+        slot &s = _slots[index];
+
+        _usage -= s.entry.accounted;
+        _saved -= s.entry.saved();
+
+        s.alive = false;
+        s.doomed = false;
+        s.owner = std::thread::id();
+        s.entry = image_entry();
+        s.generation += 1;
+
+        _count -= 1;
+
+        // g؂Xbg ID dȂ悤ɍėpȂ
+        if (s.generation <= max_generation)
+        {
+            _free.push_back(index);
+        }
+    }
+private:
+    // XbgǉĂ擾ς݂̉摜̎QƂɂȂȂ悤 deque Ŏ
+    std::deque<slot> _slots;
+    std::vector<int> _free;
+    int _count;
+    unsigned long long _clock;
+    size_t _usage;
+    size_t _budget;
+    image_loader _loader;
+    size_t _saved;
+    unsigned long long _inflated;
+    unsigned long long _inflate_time;
+    unsigned long long _inflate_max;
+    // XbhqŌĂ΂̂ōċAIɎ擾ł̂g
+    mutable std::recursive_mutex _mutex;
+    std::condition_variable_any _unpinned;
+};
+
+// ǂݍ񂾃t@C̃sNZL邽߂̃LbV
+// LbVobt@QƂĂ̂ŁAމ摜͕KĂ珑
+// LbVQƂĂobt@ trim ŉ
+// IȌĂяoƔ񓯊̌Ăяo瓯ɎĝŁASĂ̑ŃbN擾
+class image_cache
+{
+public:
+    // ύXĂȂt@C̉摜`ŎcĂ΁Aobt@LĎ擾
+    // }XNt@C̃TCYƍXVvĂKv
+    bool find(const string_t &file, size_t size, unsigned long long modified, size_t mask_size, unsigned long long mask_modified, bool premultiplied, image &img)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = _entries.find(file);
+
+        if (it == _entries.end())
+        {
+            return false;
+        }
+
+        const cache_entry &entry = it->second;
+
+        if (entry.size != size || entry.modified != modified || entry.mask_size != mask_size || entry.mask_modified != mask_modified || entry.premultiplied != premultiplied)
+        {
+            _entries.erase(it);
+            return false;
+        }
+
+        img = image(entry.width, entry.height, entry.buffer);
+        img.premultiplied(premultiplied);
+
+        return true;
+    }
+    void insert(const string_t &file, size_t size, unsigned long long modified, size_t mask_size, unsigned long long mask_modified, const image &img)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        remove_unused();
+
+        cache_entry &entry = _entries[file];
+
+        entry.size = size;
+        entry.modified = modified;
+        entry.mask_size = mask_size;
+        entry.mask_modified = mask_modified;
+        entry.width = img.width();
+        entry.height = img.height();
+        entry.premultiplied = img.premultiplied();
+        entry.buffer = img.shared_buffer();
+    }
+    // 摜̃obt@LbVQƂĂ邩
+    bool holds(const image &img)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (auto it = _entries.cbegin(); it != _entries.cend(); ++it)
+        {
+            if (it->second.buffer == img.shared_buffer())
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+    // ǂ̉摜QƂȂȂobt@
+    void trim()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        remove_unused();
+    }
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _entries.clear();
+    }
+private:
+    void remove_unused()
+    {
+        for (auto it = _entries.begin(); it != _entries.end();)
+        {
+            if (it->second.buffer.use_count() <= 1)
+            {
+                it = _entries.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+private:
+    struct cache_entry
+    {
+        size_t size;
+        unsigned long long modified;
+        size_t mask_size;
+        unsigned long long mask_modified;
+        int width;
+        int height;
+        bool premultiplied;
+        std::shared_ptr<color> buffer;
+    };
+private:
+    std::map<string_t, cache_entry> _entries;
+    std::mutex _mutex;
+};
\ No newline at end of file
@@ -0,0 +1,409 @@
+/*
+    stream.hpp
+    COLORS Streaming Conversion Library
+*/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "image.hpp"
+#include "png.hpp"
+
+// sPʂ̕ϊ֐
+typedef std::function<void(color *, int)> row_transform;
+
+// sNZPʂ̊֐IuWFNgsPʂ̕ϊ֐ɕϊ
+template<class Function>
+row_transform make_row_transform(Function f)
+{
+    return [f](color *pixels, int length)
+    {
+        for (int i = 0; i < length; ++i)
+        {
+            f(pixels[i]);
+        }
+    };
+}
+
+// \ȃTvOtB^
+struct resample_filter
+{
+    // tB^̔a
+    double support;
+    // d݂߂֐
+    double (*weight)(double);
+};
+
+// a 0 ̃tB^͓_TvOƂĈAkLȂ
+inline double point_filter(double)
+{
+    return 1.0;
+}
+
+inline double box_filter(double x)
+{
+    return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+}
+
+inline double triangle_filter(double x)
+{
+    x = std::abs(x);
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+inline double cubic_filter(double x)
+{
+    // bicubic_sampler Ɠ a = -1 ŌvZ
+    static const double a = -1.0;
+
+    x = std::abs(x);
+
+    if (x <= 1.0)
+    {
+        return 1.0 - (a + 3.0) * x * x + (a + 2.0) * x * x * x;
+    }
+    else if (x <= 2.0)
+    {
+        return -a * 4.0 + a * 8.0 * x - a * 5.0 * x * x + a * x * x * x;
+    }
+    return 0.0;
+}
+
+template<int n>
+inline double lanczos_filter(double x)
+{
+    static const double PI = 6.0 * asin(0.5);
+
+    x = std::abs(x);
+
+    if (x == 0.0)
+    {
+        return 1.0;
+    }
+    else if (x < n)
+    {
+        double dpx = PI * x;
+        return (sin(dpx) * sin(dpx / n)) / (dpx * (dpx / n));
+    }
+    return 0.0;
+}
+
+// o̓sNZƂ̎QƈʒuƏd݂̈ꗗ
+struct weight_table
+{
+    std::vector<int> offsets;
+    std::vector<int> indices;
+    std::vector<float> weights;
+
+    inline int first(int i) const
+    {
+        return indices[offsets[i]];
+    }
+    inline int last(int i) const
+    {
+        return indices[offsets[i + 1] - 1];
+    }
+    void build(int src_size, int dst_size, const resample_filter &filter)
+    {
+        offsets.clear();
+        indices.clear();
+        weights.clear();
+
+        double scale = static_cast<double>(dst_size) / src_size;
+
+        if (filter.support <= 0.0)
+        {
+            // nearest_neighbor_sampler ƓA1 ̃sNZQƂ
+            for (int i = 0; i < dst_size; ++i)
+            {
+                offsets.push_back(static_cast<int>(indices.size()));
+                indices.push_back(std::min(static_cast<int>(i / scale), src_size - 1));
+                weights.push_back(1.0f);
+            }
+            offsets.push_back(static_cast<int>(indices.size()));
+            return;
+        }
+
+        // k̓tB^LăGCAVO}
+        double filter_scale = scale < 1.0 ? 1.0 / scale : 1.0;
+        double support = filter.support * filter_scale;
+
+        for (int i = 0; i < dst_size; ++i)
+        {
+            offsets.push_back(static_cast<int>(indices.size()));
+
+            // IWił̒SʒuvZ
+            double center = (i + 0.5) / scale - 0.5;
+
+            int begin = static_cast<int>(floor(center - support));
+            int end = static_cast<int>(ceil(center + support));
+
+            double total = 0.0;
+
+            for (int j = begin; j <= end; ++j)
+            {
+                double weight = filter.weight((j - center) / filter_scale);
+
+                if (weight == 0.0)
+                {
+                    continue;
+                }
+
+                // ̈O͒[̃sNZQƂ
+                int index = std::min(std::max(j, 0), src_size - 1);
+
+                // sNZQƂꍇ͂܂Ƃ߂
+                if (static_cast<int>(indices.size()) > offsets[i] && indices.back() == index)
+                {
+                    weights.back() += static_cast<float>(weight);
+                }
+                else
+                {
+                    indices.push_back(index);
+                    weights.push_back(static_cast<float>(weight));
+                }
+
+                total += weight;
+            }
+
+            if (static_cast<int>(indices.size()) == offsets[i] || total == 0.0)
+            {
+                // d݂Ȃꍇ͍ł߂sNZg
+                indices.resize(offsets[i]);
+                weights.resize(offsets[i]);
+                indices.push_back(std::min(std::max(static_cast<int>(center + 0.5), 0), src_size - 1));
+                weights.push_back(1.0f);
+                continue;
+            }
+
+            // d݂𐳋K
+            for (int k = offsets[i]; k < static_cast<int>(weights.size()); ++k)
+            {
+                weights[k] = static_cast<float>(weights[k] / total);
+            }
+        }
+
+        offsets.push_back(static_cast<int>(indices.size()));
+    }
+    // Tv[ƓAo̓sNZ̍̉摜̈ʒuɑΉďd݂߂
+    // ktB^LȂ̂ŁAresize ̃Tv[ƓsNZQƂ
+    void build_sampled(int src_size, int dst_size, const resample_filter &filter)
+    {
+        offsets.clear();
+        indices.clear();
+        weights.clear();
+
+        double scale = static_cast<double>(dst_size) / src_size;
+        int taps = static_cast<int>(ceil(filter.support));
+
+        for (int i = 0; i < dst_size; ++i)
+        {
+            offsets.push_back(static_cast<int>(indices.size()));
+
+            double position = i / scale;
+            int base = std::min(static_cast<int>(position), src_size - 1);
+
+            if (taps <= 0)
+            {
+                indices.push_back(base);
+                weights.push_back(1.0f);
+                continue;
+            }
+
+            double total = 0.0;
+
+            for (int j = base - taps + 1; j <= base + taps; ++j)
+            {
+                double weight = filter.weight(j - position);
+
+                if (weight == 0.0)
+                {
+                    continue;
+                }
+
+                // ̈O͒[̃sNZQƂ
+                int index = std::min(std::max(j, 0), src_size - 1);
+
+                if (static_cast<int>(indices.size()) > offsets[i] && indices.back() == index)
+                {
+                    weights.back() += static_cast<float>(weight);
+                }
+                else
+                {
+                    indices.push_back(index);
+                    weights.push_back(static_cast<float>(weight));
+                }
+
+                total += weight;
+            }
+
+            if (static_cast<int>(indices.size()) == offsets[i] || total == 0.0)
+            {
+                indices.resize(offsets[i]);
+                weights.resize(offsets[i]);
+                indices.push_back(base);
+                weights.push_back(1.0f);
+                continue;
+            }
+
+            for (int k = offsets[i]; k < static_cast<int>(weights.size()); ++k)
+            {
+                weights[k] = static_cast<float>(weights[k] / total);
+            }
+        }
+
+        offsets.push_back(static_cast<int>(indices.size()));
+    }
+};
+
+// Xg[ϊp̍Ɨ̈Ag񂷂ƂŃAP[V炷
+struct stream_scratch
+{
+    std::vector<color> src_row;
+    std::vector<color> dst_row;
+    std::vector<float> ring;
+    std::vector<float> accum;
+    weight_table horizontal;
+    weight_table vertical;
+};
+
+// 1 s𐅕ɃTvO
+// o͂ first ڂ width 񕪂߂Asrc ͌̍s origin ڂw
+inline void resample_row(const color *src, float *dst, const weight_table &table, int width, int first = 0, int origin = 0)
+{
+    for (int x = first; x < first + width; ++x)
+    {
+        float alpha = 0.0f, red = 0.0f, green = 0.0f, blue = 0.0f;
+
+        for (int k = table.offsets[x]; k < table.offsets[x + 1]; ++k)
+        {
+            const color &pixel = src[table.indices[k] - origin];
+            float weight = table.weights[k];
+
+            alpha += pixel.alpha() * weight;
+            red += pixel.red() * weight;
+            green += pixel.green() * weight;
+            blue += pixel.blue() * weight;
+        }
+
+        dst[0] = alpha;
+        dst[1] = red;
+        dst[2] = green;
+        dst[3] = blue;
+
+        dst += 4;
+    }
+}
+
+// PNG  1 sǂݍ݁AϊƃTvOsȂ珑o
+// gp郁̓tB^̍ x s̕Ɏ܂
+bool stream_convert(png_reader &reader, png_writer &writer, int width, int height, const resample_filter &filter, const row_transform &transform, stream_scratch &scratch)
+{
+    int src_width = reader.width();
+    int src_height = reader.height();
+
+    if (src_width <= 0 || src_height <= 0 || width <= 0 || height <= 0)
+    {
+        return false;
+    }
+
+    scratch.src_row.resize(src_width);
+
+    // TCYꍇ͕ϊs
+    if (src_width == width && src_height == height)
+    {
+        color *row = &scratch.src_row[0];
+
+        for (int y = 0; y < height; ++y)
+        {
+            if (!reader.read_row(row))
+            {
+                return false;
+            }
+
+            if (transform)
+            {
+                transform(row, width);
+            }
+
+            writer.write_row(row);
+        }
+
+        return true;
+    }
+
+    // d݂OɌvZ
+    scratch.horizontal.build(src_width, width, filter);
+    scratch.vertical.build(src_height, height, filter);
+
+    // ɕKvȍs߂ăOobt@mۂ
+    int ring_size = 1;
+    for (int y = 0; y < height; ++y)
+    {
+        ring_size = std::max(ring_size, scratch.vertical.last(y) - scratch.vertical.first(y) + 1);
+    }
+
+    int stride = width * 4;
+
+    scratch.ring.resize(static_cast<size_t>(ring_size) * stride);
+    scratch.accum.resize(stride);
+    scratch.dst_row.resize(width);
+
+    color *src_row = &scratch.src_row[0];
+    color *dst_row = &scratch.dst_row[0];
+    float *ring = &scratch.ring[0];
+    float *accum = &scratch.accum[0];
+
+    // ɓǂݍރ\[X̍s
+    int next_row = 0;
+
+    for (int y = 0; y < height; ++y)
+    {
+        // Kvȍs܂łǂݍ݁AɃTvOăOobt@ɐς
+        while (next_row <= scratch.vertical.last(y))
+        {
+            if (!reader.read_row(src_row))
+            {
+                return false;
+            }
+
+            if (transform)
+            {
+                transform(src_row, src_width);
+            }
+
+            resample_row(src_row, &ring[static_cast<size_t>(next_row % ring_size) * stride], scratch.horizontal, width);
+
+            next_row += 1;
+        }
+
+        // ɏdݕts
+        std::fill(scratch.accum.begin(), scratch.accum.end(), 0.0f);
+
+        for (int k = scratch.vertical.offsets[y]; k < scratch.vertical.offsets[y + 1]; ++k)
+        {
+            const float *row = &ring[static_cast<size_t>(scratch.vertical.indices[k] % ring_size) * stride];
+            float weight = scratch.vertical.weights[k];
+
+            for (int i = 0; i < stride; ++i)
+            {
+                accum[i] += row[i] * weight;
+            }
+        }
+
+        for (int x = 0; x < width; ++x)
+        {
+            const float *p = &accum[x * 4];
+
+            dst_row[x] = color(static_cast<int>(p[0] + 0.5f), static_cast<int>(p[1] + 0.5f), static_cast<int>(p[2] + 0.5f), static_cast<int>(p[3] + 0.5f));
+        }
+
+        writer.write_row(dst_row);
+    }
+
+    return true;
+}
\ No newline at end of file
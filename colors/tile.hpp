@@ -0,0 +1,450 @@
+/*
+    tile.hpp
+    COLORS Tiled Image Library
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "image.hpp"
+#include "drawing.hpp"
+#include "png.hpp"
+#include "filter.hpp"
+#include "stream.hpp"
+
+// 64x64 ̃^Cɕĕێ摜
+// ^C͏܂ꂽ_Ŋmۂ̂ŁAȗ̈̓Ȃ
+class tiled_image
+{
+public:
+    static const int tile_size = 64;
+
+    tiled_image(int width, int height)
+        : _width(width), _height(height), _columns((width + tile_size - 1) / tile_size), _rows((height + tile_size - 1) / tile_size), _premultiplied(false)
+    {
+        _tiles.resize(static_cast<size_t>(_columns) * _rows);
+    }
+    inline int width() const
+    {
+        return _width;
+    }
+    inline int height() const
+    {
+        return _height;
+    }
+    inline int columns() const
+    {
+        return _columns;
+    }
+    inline int rows() const
+    {
+        return _rows;
+    }
+    inline bool premultiplied() const
+    {
+        return _premultiplied;
+    }
+    inline void premultiplied(bool value)
+    {
+        _premultiplied = value;
+    }
+    // ^C擾AmۂĂȂꍇ NULL Ԃ
+    inline const image *tile(int column, int row) const
+    {
+        const image &t = _tiles[static_cast<size_t>(_columns) * row + column];
+        return t.width() != 0 ? &t : NULL;
+    }
+    // ݗpɃ^C擾AmۂĂȂΓȃ^Cmۂ
+    image &tile(int column, int row)
+    {
+        image &t = _tiles[static_cast<size_t>(_columns) * row + column];
+        if (t.width() == 0)
+        {
+            t.resize(tile_size, tile_size);
+            t.premultiplied(_premultiplied);
+        }
+        return t;
+    }
+    // mۂĂ^CgpĂ郁
+    size_t bytes() const
+    {
+        size_t total = 0;
+        for (auto it = _tiles.cbegin(); it != _tiles.cend(); ++it)
+        {
+            total += static_cast<size_t>(it->stride()) * it->height() * sizeof(color);
+        }
+        return total;
+    }
+    inline void pixel(const color &value, int x, int y)
+    {
+        if (x >= 0 && x < _width && y >= 0 && y < _height)
+        {
+            tile(x / tile_size, y / tile_size).pixel_no_check(value, x % tile_size, y % tile_size);
+        }
+    }
+    inline color pixel(int x, int y) const
+    {
+        if (x >= 0 && x < _width && y >= 0 && y < _height)
+        {
+            const image *t = tile(x / tile_size, y / tile_size);
+            if (t != NULL)
+            {
+                return t->pixel_no_check(x % tile_size, y % tile_size);
+            }
+        }
+        return color();
+    }
+    // 1 s̃sNZ^CW߂AmۂĂȂ^C͓ɂȂ
+    void read_row(color *dst, int y, int x = 0, int width = -1) const
+    {
+        if (width < 0)
+        {
+            width = _width - x;
+        }
+
+        int row = y / tile_size;
+        int ty = y % tile_size;
+
+        while (width > 0)
+        {
+            int column = x / tile_size;
+            int tx = x % tile_size;
+            int length = std::min(width, tile_size - tx);
+
+            const image *t = tile(column, row);
+
+            if (t != NULL)
+            {
+                memcpy(dst, t->row(ty) + tx, length * sizeof(color));
+            }
+            else
+            {
+                std::fill(dst, dst + length, color());
+            }
+
+            dst += length;
+            x += length;
+            width -= length;
+        }
+    }
+    // ͈͂ƏdȂ^C 1 łmۂĂ邩A͈͂͂͂ݏoĂĂǂ
+    bool allocated(int x, int y, int width, int height) const
+    {
+        int left = std::max(x, 0);
+        int top = std::max(y, 0);
+        int right = std::min(x + width, _width);
+        int bottom = std::min(y + height, _height);
+
+        if (left >= right || top >= bottom)
+        {
+            return false;
+        }
+
+        for (int row = top / tile_size; row <= (bottom - 1) / tile_size; ++row)
+        {
+            for (int column = left / tile_size; column <= (right - 1) / tile_size; ++column)
+            {
+                if (tile(column, row) != NULL)
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    // 摜`悷A`ƏdȂ^C
+    bool draw(const image &elem, int x, int y, int opacity)
+    {
+        // `قȂꍇ͐ɈxϊĂ
+        if (elem.premultiplied() != _premultiplied)
+        {
+            image converted(elem);
+
+            if (_premultiplied)
+            {
+                converted.premultiply();
+            }
+            else
+            {
+                converted.unpremultiply();
+            }
+
+            return draw(converted, x, y, opacity);
+        }
+
+        return draw_tiles(x, y, elem.width(), elem.height(), [&](image &t, int tx, int ty)
+        {
+            draw_image(t, elem, tx, ty, opacity);
+        });
+    }
+    // pbg摜`悷Apbǧ`͐Ɉx
+    bool draw(const indexed_image &elem, int x, int y, int opacity)
+    {
+        if (elem.premultiplied() != _premultiplied)
+        {
+            indexed_image converted(elem);
+
+            if (_premultiplied)
+            {
+                converted.premultiply();
+            }
+            else
+            {
+                converted.unpremultiply();
+            }
+
+            return draw(converted, x, y, opacity);
+        }
+
+        return draw_tiles(x, y, elem.width(), elem.height(), [&](image &t, int tx, int ty)
+        {
+            draw_indexed(t, elem, tx, ty, opacity);
+        });
+    }
+    // }XNw肵Fŕ`悷
+    bool draw(const alpha_mask &mask, const color &fill_color, int x, int y, int opacity)
+    {
+        return draw_tiles(x, y, mask.width(), mask.height(), [&](image &t, int tx, int ty)
+        {
+            draw_mask(t, mask, fill_color, tx, ty, opacity);
+        });
+    }
+    // ͈͂ƏdȂ^CɁA^C̍Wɕϊĕ`֐Ăяo
+    // ͂ݏo͕`֐؂
+    template<class Function>
+    bool draw_tiles(int x, int y, int width, int height, Function f)
+    {
+        int left = std::max(x, 0);
+        int top = std::max(y, 0);
+        int right = std::min(x + width, _width);
+        int bottom = std::min(y + height, _height);
+
+        if (left >= right || top >= bottom)
+        {
+            return false;
+        }
+
+        for (int row = top / tile_size; row <= (bottom - 1) / tile_size; ++row)
+        {
+            for (int column = left / tile_size; column <= (right - 1) / tile_size; ++column)
+            {
+                f(tile(column, row), x - column * tile_size, y - row * tile_size);
+            }
+        }
+        return true;
+    }
+    // ŜhԂAœhԂꍇ̓^C
+    void fill(const color &fill_color)
+    {
+        for (int row = 0; row < _rows; ++row)
+        {
+            for (int column = 0; column < _columns; ++column)
+            {
+                if (fill_color == color())
+                {
+                    _tiles[static_cast<size_t>(_columns) * row + column] = image();
+                }
+                else
+                {
+                    fill_image(tile(column, row), fill_color);
+                }
+            }
+        }
+    }
+    // ꕔʏ̉摜ƂĐ؂o
+    bool sub_image(image &dst, int x, int y, int width, int height) const
+    {
+        int left = std::max(x, 0);
+        int top = std::max(y, 0);
+        int right = std::min(x + width, _width);
+        int bottom = std::min(y + height, _height);
+
+        if (left >= right || top >= bottom || !dst.resize(right - left, bottom - top, false))
+        {
+            return false;
+        }
+
+        dst.premultiplied(_premultiplied);
+
+        for (int i = top; i < bottom; ++i)
+        {
+            read_row(dst.row(i - top), i, left, right - left);
+        }
+        return true;
+    }
+private:
+    int _width;
+    int _height;
+    int _columns;
+    int _rows;
+    bool _premultiplied;
+    // mۂĂȂ^C͕ 0 ̉摜ɂȂ
+    std::vector<image> _tiles;
+};
+
+// ^CPʂ̉摜sPʂŏoAŜWJɕۑł
+bool png_save_image(const string_t &file, const tiled_image &src)
+{
+    png_writer writer;
+
+    if (!writer.open(file, src.width(), src.height()))
+    {
+        return false;
+    }
+
+    const alpha_table &table = alpha_table::instance();
+
+    std::vector<color> row(src.width());
+
+    for (int i = 0; i < src.height(); ++i)
+    {
+        src.read_row(&row[0], i);
+
+        // Zς݃At@̏ꍇ̓Xg[gAt@ɖ߂
+        if (src.premultiplied())
+        {
+            for (auto it = row.begin(); it != row.end(); ++it)
+            {
+                *it = unpremultiply_color(*it, table);
+            }
+        }
+
+        writer.write_row(&row[0]);
+    }
+
+    return writer.close();
+}
+
+// ^CPʂ̉摜TvOA`̃^CɐƐ̏s
+// ̏̓^C̗̕񂾂Ώۂɂ̂ŁAƗ͎̈QƂs x ^C̕Ɏ܂
+// QƂ͈͂Ƀ^CmۂĂȂ`̃^ĆAȂ̂ŊmۂȂ
+void resample_tiles(const tiled_image &src, tiled_image &dst, const resample_filter &filter)
+{
+    static const int tile_size = tiled_image::tile_size;
+
+    weight_table horizontal;
+    weight_table vertical;
+
+    horizontal.build(src.width(), dst.width(), filter);
+    vertical.build(src.height(), dst.height(), filter);
+
+    std::vector<color> src_row;
+    std::vector<float> rows;
+    std::vector<float> accum(tile_size * 4);
+
+    for (int row = 0; row < dst.rows(); ++row)
+    {
+        int top = row * tile_size;
+        int bottom = std::min(top + tile_size, dst.height());
+
+        // QƂ錳̍s͈̔
+        int src_top = vertical.first(top);
+        int src_bottom = vertical.last(bottom - 1) + 1;
+
+        for (int column = 0; column < dst.columns(); ++column)
+        {
+            int left = column * tile_size;
+            int right = std::min(left + tile_size, dst.width());
+
+            // QƂ錳̗͈̔
+            int src_left = horizontal.first(left);
+            int src_right = horizontal.last(right - 1) + 1;
+
+            if (!src.allocated(src_left, src_top, src_right - src_left, src_bottom - src_top))
+            {
+                continue;
+            }
+
+            int width = right - left;
+            int stride = width * 4;
+
+            src_row.resize(src_right - src_left);
+            rows.resize(static_cast<size_t>(src_bottom - src_top) * stride);
+
+            // QƂ錳̍sÃ^C̗̕ɃTvO
+            for (int y = src_top; y < src_bottom; ++y)
+            {
+                src.read_row(&src_row[0], y, src_left, src_right - src_left);
+
+                resample_row(&src_row[0], &rows[static_cast<size_t>(y - src_top) * stride], horizontal, width, left, src_left);
+            }
+
+            image &t = dst.tile(column, row);
+
+            // ɏdݕts
+            for (int y = top; y < bottom; ++y)
+            {
+                std::fill(accum.begin(), accum.begin() + stride, 0.0f);
+
+                for (int k = vertical.offsets[y]; k < vertical.offsets[y + 1]; ++k)
+                {
+                    const float *p = &rows[static_cast<size_t>(vertical.indices[k] - src_top) * stride];
+                    float weight = vertical.weights[k];
+
+                    for (int i = 0; i < stride; ++i)
+                    {
+                        accum[i] += p[i] * weight;
+                    }
+                }
+
+                color *out = t.row(y - top);
+
+                for (int x = 0; x < width; ++x)
+                {
+                    const float *p = &accum[x * 4];
+
+                    out[x] = color(static_cast<int>(p[0] + 0.5f), static_cast<int>(p[1] + 0.5f), static_cast<int>(p[2] + 0.5f), static_cast<int>(p[3] + 0.5f));
+                }
+            }
+        }
+    }
+}
+
+// ^CPʂ̉摜ڂA`̃^CɎ͂܂߂͈͂؂oĂڂ
+// {bNXtB^ 3 񂩂̂ŁAa 3 {̎͂΃^Čʂ͑Ŝڂꍇƈv
+void blur_tiles(const tiled_image &src, tiled_image &dst, int radius)
+{
+    static const int tile_size = tiled_image::tile_size;
+
+    int margin = radius * 3;
+
+    image region;
+    image blurred;
+
+    for (int row = 0; row < src.rows(); ++row)
+    {
+        for (int column = 0; column < src.columns(); ++column)
+        {
+            int left = column * tile_size;
+            int top = row * tile_size;
+            int width = std::min(tile_size, src.width() - left);
+            int height = std::min(tile_size, src.height() - top);
+
+            // ͂ɂmۂꂽ^CΓ̂܂
+            if (!src.allocated(left - margin, top - margin, width + margin * 2, height + margin * 2))
+            {
+                continue;
+            }
+
+            // ؂o͈͉͂摜̓Ɏ܂悤ɐ؂l߂
+            int x = std::max(left - margin, 0);
+            int y = std::max(top - margin, 0);
+
+            if (!src.sub_image(region, left - margin, top - margin, width + margin * 2, height + margin * 2))
+            {
+                continue;
+            }
+
+            blur_image(region, blurred, radius);
+
+            image &t = dst.tile(column, row);
+
+            for (int i = 0; i < height; ++i)
+            {
+                memcpy(t.row(i), blurred.row(top - y + i) + (left - x), width * sizeof(color));
+            }
+        }
+    }
+}
\ No newline at end of file